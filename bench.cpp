@@ -0,0 +1,501 @@
+#define _XOPEN_SOURCE
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "event.hpp"
+#include "observer.hpp"
+#include "event_parser.hpp"
+#include "event_generator.hpp"
+#include "event_stats.hpp"
+
+using namespace std;
+
+// Accuracy-vs-cost benchmark of the event_stats strategies.
+// The log is replayed into memory once, then the exact top-k of every second is computed
+// with the top_simple semantics (sizes and counts of the events of the last period).
+// Every strategy and events_limit pair is replayed in its own forked process, so that
+// peak RSS is its own, and compared with the exact top-k second by second.
+
+typedef vector<Event> EventContainer;
+
+// Collects replayed events in memory
+class EventCollector : public IObserver
+{
+public:
+    EventContainer &Events() { return events_; }
+
+private:
+    // IObserver
+    virtual void NotifyObserver( const Event &event )
+    {
+        events_.push_back( event );
+    }
+
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        events_.insert( events_.end(), events, events + count );
+    }
+
+private:
+    EventContainer events_;
+};
+
+// Exact top-k of the window as top_simple::get_top computes it, but with per-key totals
+// kept up to date as events enter and leave the window instead of a rescan per call
+class ExactTop
+{
+public:
+    ExactTop( int period )
+    : period_( period )
+    {}
+
+    void Add( const Event &event )
+    {
+        window_.push_back( event );
+        auto it = totals_.find( event.key );
+        if (it == totals_.end())
+        {
+            Event e( event );
+            e.freq = 1;
+            totals_.emplace( event.key, e );
+        }
+        else
+        {
+            it->second.size += event.size;
+            ++it->second.freq;
+        }
+    }
+
+    void GetTop( size_t k, time_t time, EventContainer &top_size, EventContainer &top_freq )
+    {
+        while( !window_.empty() && window_.front().time < time - period_ )
+        {
+            const Event &e = window_.front();
+            auto it = totals_.find( e.key );
+            it->second.size -= e.size;
+            if (--it->second.freq == 0)
+                totals_.erase( it );
+            window_.pop_front();
+        }
+
+        EventContainer all;
+        all.reserve( totals_.size() );
+        for( const auto &t : totals_ )
+        {
+            all.push_back( t.second );
+        }
+
+        TopK( all, k, &Event::size_compare, top_size );
+        TopK( all, k, &Event::freq_compare, top_freq );
+    }
+
+private:
+    static void TopK( const EventContainer &all, size_t k, bool (*less)(const Event &, const Event &), EventContainer &top )
+    {
+        top.resize( min( k, all.size() ) );
+        partial_sort_copy( all.begin(), all.end(), top.begin(), top.end(),
+                           [less]( const Event &lhs, const Event &rhs ) { return less( rhs, lhs ); } );
+    }
+
+private:
+    int period_;
+    deque<Event> window_;
+    unordered_map<Event::id_type, Event> totals_;
+};
+
+// Feeds events as main does: in batches up to and including the first event of a new
+// second, then top(t) for every second passed, missed ones included
+template<typename AddF, typename TopF>
+static void Replay( const EventContainer &events, AddF add, TopF top )
+{
+    if (events.empty())
+        return;
+
+    time_t last_time = events[0].time;
+    size_t start = 0;
+    for(size_t i = 0; i < events.size(); ++i)
+    {
+        if (events[i].time != last_time)
+        {
+            add( &events[start], i + 1 - start );
+            start = i + 1;
+            for(time_t t = last_time + 1; t <= events[i].time; ++t)
+            {
+                top( t );
+            }
+            last_time = events[i].time;
+        }
+    }
+    if (start < events.size())
+        add( &events[start], events.size() - start );
+}
+
+struct Reference
+{
+    EventContainer top_size, top_freq;
+};
+
+// Results of one run, passed from the child process as is
+struct RunResult
+{
+    double events_per_sec;
+    double top_p50_us, top_p99_us, top_max_us;
+    double size_precision, size_recall;
+    double freq_precision, freq_recall;
+    double size_error;
+    long rss_growth_kb;
+};
+
+class Accuracy
+{
+public:
+    Accuracy()
+    : precision_( 0. ), recall_( 0. ), error_( 0. ), num_tops_( 0 ), num_matches_( 0 )
+    {}
+
+    // relative error of sizes is accumulated if with_size_error
+    void Add( const EventContainer &top, const EventContainer &reference, bool with_size_error )
+    {
+        if (reference.empty())
+            return;
+
+        unordered_map<Event::id_type, uint64_t> sizes;
+        for( const auto &e : reference )
+        {
+            sizes.emplace( e.key, e.size );
+        }
+
+        size_t overlap = 0;
+        for( const auto &e : top )
+        {
+            auto it = sizes.find( e.key );
+            if (it == sizes.end())
+                continue;
+            ++overlap;
+            if (with_size_error && it->second)
+            {
+                error_ += fabs( double(e.size) - double(it->second) ) / it->second;
+                ++num_matches_;
+            }
+        }
+
+        precision_ += top.empty() ? 0. : double(overlap) / top.size();
+        recall_ += double(overlap) / reference.size();
+        ++num_tops_;
+    }
+
+    double Precision() const { return num_tops_ ? precision_ / num_tops_ : 0.; }
+    double Recall() const { return num_tops_ ? recall_ / num_tops_ : 0.; }
+    double SizeError() const { return num_matches_ ? error_ / num_matches_ : 0.; }
+
+private:
+    double precision_, recall_, error_;
+    size_t num_tops_, num_matches_;
+};
+
+// value of a "Vm...:" line of /proc/self/status in KB, -1 if there is none
+static long ProcStatusKb( const char *field )
+{
+    ifstream status( "/proc/self/status" );
+    string line;
+    const size_t len = strlen( field );
+    while( getline( status, line ) )
+    {
+        if (!line.compare( 0, len, field ) && line.size() > len && line[len] == ':')
+            return atol( line.c_str() + len + 1 );
+    }
+    return -1;
+}
+
+// Peak RSS growth from the call to Start: the high water mark is reset through clear_refs,
+// since the forked child inherits the one of the parent holding the replayed log
+class PeakRss
+{
+public:
+    void Start()
+    {
+        ofstream( "/proc/self/clear_refs" ) << "5";
+        start_kb_ = ProcStatusKb( "VmRSS" );
+    }
+
+    long GrowthKb() const
+    {
+        return ProcStatusKb( "VmHWM" ) - start_kb_;
+    }
+
+private:
+    long start_kb_;
+};
+
+static double Percentile( vector<double> &values, double p )
+{
+    if (values.empty())
+        return 0.;
+    const size_t n = min( values.size() - 1, size_t(p * values.size()) );
+    nth_element( values.begin(), values.begin() + n, values.end() );
+    return values[n];
+}
+
+static RunResult Run( const EventContainer &events, const vector<Reference> &reference,
+                      const string &strategy, size_t events_limit, size_t k, int period )
+{
+    typedef chrono::steady_clock Clock;
+
+    PeakRss rss;
+    rss.Start();
+    unique_ptr< event_stats<Event> > stats = event_stats<Event>::create( strategy, events_limit, k, period );
+
+    Clock::duration add_time( 0 );
+    vector<double> top_us;
+    top_us.reserve( reference.size() );
+    Accuracy size_accuracy, freq_accuracy;
+    size_t second = 0;
+
+    Replay( events,
+            [&]( const Event *batch, size_t count )
+            {
+                const Clock::time_point start = Clock::now();
+                stats->add_events( batch, count );
+                add_time += Clock::now() - start;
+            },
+            [&]( time_t time )
+            {
+                EventContainer top_size, top_freq;
+                const Clock::time_point start = Clock::now();
+                stats->get_top( k, period, time, top_size, top_freq );
+                top_us.push_back( chrono::duration<double, micro>( Clock::now() - start ).count() );
+
+                size_accuracy.Add( top_size, reference[second].top_size, true );
+                freq_accuracy.Add( top_freq, reference[second].top_freq, false );
+                ++second;
+            } );
+
+    RunResult result;
+    const double add_seconds = chrono::duration<double>( add_time ).count();
+    result.events_per_sec = add_seconds > 0. ? events.size() / add_seconds : 0.;
+    result.top_p50_us = Percentile( top_us, 0.5 );
+    result.top_p99_us = Percentile( top_us, 0.99 );
+    result.top_max_us = top_us.empty() ? 0. : *max_element( top_us.begin(), top_us.end() );
+    result.size_precision = size_accuracy.Precision();
+    result.size_recall = size_accuracy.Recall();
+    result.freq_precision = freq_accuracy.Precision();
+    result.freq_recall = freq_accuracy.Recall();
+    result.size_error = size_accuracy.SizeError();
+
+    result.rss_growth_kb = rss.GrowthKb();
+    return result;
+}
+
+// Runs in a child process, returns false if it failed
+static bool RunForked( const EventContainer &events, const vector<Reference> &reference,
+                       const string &strategy, size_t events_limit, size_t k, int period, RunResult &result )
+{
+    int fds[2];
+    if (pipe( fds ))
+        throw runtime_error( string( "pipe: " ) + strerror( errno ) );
+
+    cout.flush();
+    const pid_t pid = fork();
+    if (pid < 0)
+        throw runtime_error( string( "fork: " ) + strerror( errno ) );
+
+    if (pid == 0)
+    {
+        close( fds[0] );
+        int status = 1;
+        try
+        {
+            const RunResult r = Run( events, reference, strategy, events_limit, k, period );
+            if (write( fds[1], &r, sizeof(r) ) == sizeof(r))
+                status = 0;
+        }
+        catch(exception &e)
+        {
+            cerr << strategy << ": " << e.what() << endl;
+        }
+        _exit( status );
+    }
+
+    close( fds[1] );
+    const ssize_t n = read( fds[0], &result, sizeof(result) );
+    close( fds[0] );
+    int status;
+    waitpid( pid, &status, 0 );
+    return n == sizeof(result) && WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
+
+static vector<string> SplitList( const char *list )
+{
+    vector<string> items;
+    istringstream stream( list );
+    string item;
+    while( getline( stream, item, ',' ) )
+    {
+        items.push_back( item );
+    }
+    return items;
+}
+
+static void Usage(const char *prog)
+{
+    cerr << "usage: " << prog << " [-t strategy,...] [-n events_limit,...] [-k top_k] [-w seconds] [-z local|utc|+HHMM] [-g spec] file..." << endl
+         << "  -t  strategies to compare: " << event_stats<Event>::strategy_names() << endl
+         << "      all but simple by default" << endl
+         << "  -n  events_limit values, 1000,10000,100000 by default" << endl
+         << "  -k  size of the top, 50 by default" << endl
+         << "  -w  window in seconds, 300 by default" << endl
+         << "  -z  time zone of the log timestamps, local by default" << endl
+         << "  -g  benchmark on a synthetic workload instead of files, spec as of m -g" << endl
+         << "several files, each ordered by time, are merged by time while being replayed" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    vector<string> strategies = SplitList( "slices,lru,lru-tinylfu,lru-decay,space-saving" );
+    vector<string> limits = SplitList( "1000,10000,100000" );
+    size_t k = 50;
+    int period = 5 * 60;
+    string zone = "local";
+    GeneratorConfig generator_config;
+    bool generate = false;
+    int opt;
+    while( ( opt = getopt( argc, argv, "t:n:k:w:z:g:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 't':
+                strategies = SplitList( optarg );
+                break;
+            case 'n':
+                limits = SplitList( optarg );
+                break;
+            case 'k':
+                k = max( atoi( optarg ), 1 );
+                break;
+            case 'w':
+                period = max( atoi( optarg ), 1 );
+                break;
+            case 'z':
+                zone = optarg;
+                break;
+            case 'g':
+                try
+                {
+                    generator_config.Parse( optarg );
+                }
+                catch(exception &e)
+                {
+                    cerr << e.what() << endl;
+                    return 1;
+                }
+                generate = true;
+                break;
+            default:
+                Usage( argv[0] );
+                return 1;
+        }
+    }
+
+    if (optind >= argc && !generate) {
+        cerr << "file name argument expected" << endl;
+        Usage( argv[0] );
+        return 1;
+    }
+
+    try
+    {
+        EventCollector collector;
+        EventParser parser;
+        if ( !parser.SetTimeZone( zone ) ) {
+            cerr << "invalid time zone: " << zone << endl;
+            return 1;
+        }
+        parser.Subscribe( &collector );
+        if (generate)
+        {
+            EventGenerator generator( generator_config );
+            generator.Subscribe( &collector );
+            generator.Generate();
+        }
+        else if (argc - optind > 1)
+            parser.ParseMerged( vector<const char *>( argv + optind, argv + argc ), false );
+        else
+            parser.Parse( argv[optind] );
+        const EventContainer &events = collector.Events();
+
+        vector<Reference> reference;
+        ExactTop exact( period );
+        Replay( events,
+                [&]( const Event *batch, size_t count )
+                {
+                    for(size_t i = 0; i < count; ++i)
+                    {
+                        exact.Add( batch[i] );
+                    }
+                },
+                [&]( time_t time )
+                {
+                    reference.push_back( Reference() );
+                    exact.GetTop( k, time, reference.back().top_size, reference.back().top_freq );
+                } );
+
+        struct rusage usage;
+        getrusage( RUSAGE_SELF, &usage );
+        cout << events.size() << " events, " << reference.size() << " seconds, top " << k
+             << ", window " << period << "s, rss of the replayed log " << usage.ru_maxrss << " KB" << endl;
+
+        cout << left << setw( 14 ) << "strategy" << right
+             << setw( 8 ) << "limit" << setw( 12 ) << "events/s"
+             << setw( 10 ) << "top_p50" << setw( 10 ) << "top_p99" << setw( 10 ) << "top_max"
+             << setw( 8 ) << "prec_s" << setw( 8 ) << "rec_s" << setw( 8 ) << "prec_f" << setw( 8 ) << "rec_f"
+             << setw( 8 ) << "err_s" << setw( 10 ) << "rss_kb" << endl;
+
+        for( const auto &strategy : strategies )
+        {
+            for( const auto &limit : limits )
+            {
+                RunResult r;
+                cout << left << setw( 14 ) << strategy << right << setw( 8 ) << limit;
+                if (!RunForked( events, reference, strategy, atoi( limit.c_str() ), k, period, r ))
+                {
+                    cout << "  failed" << endl;
+                    continue;
+                }
+                cout << fixed
+                     << setw( 12 ) << setprecision( 0 ) << r.events_per_sec
+                     << setw( 10 ) << setprecision( 1 ) << r.top_p50_us
+                     << setw( 10 ) << r.top_p99_us << setw( 10 ) << r.top_max_us
+                     << setprecision( 3 )
+                     << setw( 8 ) << r.size_precision << setw( 8 ) << r.size_recall
+                     << setw( 8 ) << r.freq_precision << setw( 8 ) << r.freq_recall
+                     << setw( 8 ) << r.size_error
+                     << setw( 10 ) << r.rss_growth_kb << endl;
+            }
+        }
+        cout << "latencies of get_top in microseconds; prec/rec of top by size (_s) and frequency (_f);" << endl
+             << "err_s is the mean relative size error of keys found in both tops;" << endl
+             << "rss_kb is the peak RSS growth during the run" << endl;
+    }
+    catch(exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1 +1,3 @@
-clang++ -Wall --std=c++0x -O2 -g main.cpp -o m
+clang++ -Wall --std=c++0x -O2 -g -pthread main.cpp -o m -lz
+clang++ -Wall --std=c++0x -O2 -g -pthread bench.cpp -o bench -lz
+clang++ -Wall --std=c++0x -O2 -g -pthread top_server_check.cpp -o top_server_check && ./top_server_check
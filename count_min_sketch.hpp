@@ -0,0 +1,87 @@
+#ifndef COUNT_MIN_SKETCH_HPP
+#define COUNT_MIN_SKETCH_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include "string_table.hpp"
+
+// Count-min sketch of integer keys with conservative update: add only raises the
+// counters that are below the new estimate, which keeps overestimation of rare keys low.
+// Counters of DEPTH rows are indexed by double hashing of one 64-bit hash of the key.
+// After every reset_period adds all counters are halved, so old counts fade out
+// (the aging of TinyLFU). Counters saturate instead of wrapping around.
+template<typename counter_type>
+class count_min_sketch {
+
+public:
+	count_min_sketch(size_t width, uint64_t reset_period): adds(0), reset_period(reset_period) {
+		size_t n = 16;
+		while (n < width) {
+			n <<= 1;
+		}
+		mask = n - 1;
+		counters.assign(DEPTH * n, 0);
+	}
+
+	// adds amount to the key and returns its new estimate
+	uint64_t add(uint64_t key, uint64_t amount) {
+		size_t index[DEPTH];
+		slots(key, index);
+
+		uint64_t estimate = std::numeric_limits<uint64_t>::max();
+		for (int i = 0; i < DEPTH; ++i) {
+			estimate = std::min<uint64_t>(estimate, counters[index[i]]);
+		}
+		estimate = std::min<uint64_t>(estimate + amount, std::numeric_limits<counter_type>::max());
+		for (int i = 0; i < DEPTH; ++i) {
+			if (counters[index[i]] < estimate) {
+				counters[index[i]] = estimate;
+			}
+		}
+
+		if (++adds == reset_period) {
+			halve();
+		}
+		return estimate;
+	}
+
+	uint64_t estimate(uint64_t key) const {
+		size_t index[DEPTH];
+		slots(key, index);
+
+		uint64_t estimate = std::numeric_limits<uint64_t>::max();
+		for (int i = 0; i < DEPTH; ++i) {
+			estimate = std::min<uint64_t>(estimate, counters[index[i]]);
+		}
+		return estimate;
+	}
+
+	void halve() {
+		for (auto &c : counters) {
+			c >>= 1;
+		}
+		adds = 0;
+	}
+
+private:
+	enum { DEPTH = 4 };
+
+	void slots(uint64_t key, size_t *index) const {
+		key = mix_id(key);
+
+		const size_t h1 = key;
+		const size_t h2 = (key >> 32) | 1;
+		for (int i = 0; i < DEPTH; ++i) {
+			index[i] = i * (mask + 1) + ((h1 + i * h2) & mask);
+		}
+	}
+
+	std::vector<counter_type> counters;
+	size_t mask;
+	uint64_t adds;
+	uint64_t reset_period;
+};
+
+#endif // COUNT_MIN_SKETCH_HPP
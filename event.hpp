@@ -0,0 +1,52 @@
+#ifndef EVENT_HPP
+#define EVENT_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include "string_table.hpp"
+
+using namespace std;
+
+// Keys and request names of all events, events refer to them by id
+inline string_table &Strings()
+{
+    static string_table table;
+    return table;
+}
+
+struct Event
+{
+    typedef string_table::id_type id_type;
+
+    time_t time;
+    id_type request;
+    id_type key;
+    uint64_t size;
+    uint64_t freq;
+    double freq_double;
+
+    uint64_t get_size() const { return size; }
+    void set_size(uint64_t size) { this->size = size; }
+
+    uint64_t get_freq() const { return freq; }
+    void set_freq(uint64_t freq) { this->freq = freq; }
+
+    double get_freq_double() const { return freq_double; }
+    void set_freq(double freq) { this->freq_double = freq; }
+
+    static bool size_compare(const Event &e1, const Event &e2) { return e1.size < e2.size; }
+    static bool time_compare(const Event &e1, const Event &e2) { return e1.time < e2.time; }
+    static bool freq_compare(const Event &e1, const Event &e2) { return e1.freq < e2.freq; }
+    static bool freq_double_compare(const Event &e1, const Event &e2) { return e1.freq_double < e2.freq_double; }
+    bool operator < (const Event &e) const { return key < e.key; }
+};
+
+inline std::ostream& operator << (std::ostream& os, const Event &e)
+{
+    os << "event = {key: " << Strings().lookup( e.key ) << ", request: " << Strings().lookup( e.request )
+       << ", freq: " << e.freq << ", freq_d: " << e.freq_double << ", time: " << e.time << ", size: " << e.size << "}";
+    return os;
+}
+
+#endif // EVENT_HPP
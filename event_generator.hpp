@@ -0,0 +1,254 @@
+#ifndef EVENT_GENERATOR_HPP
+#define EVENT_GENERATOR_HPP
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include "event.hpp"
+#include "observer.hpp"
+
+// Parameters of a synthetic workload, see EventGenerator
+struct GeneratorConfig
+{
+    uint64_t events = 1000000;
+    uint64_t keys = 100000;
+    double zipf = 1.0;              // skew of key popularity
+    uint64_t rate = 1000;           // events per second
+    time_t start = 1419206400;      // 2014-12-22 00:00:00 UTC
+    double size_mu = 9.7;           // object sizes are lognormal, median exp(size_mu) bytes
+    double size_sigma = 1.0;
+    uint64_t clients = 50;          // request field, clients are Zipf distributed too
+    double client_zipf = 0.5;
+    double burst_rate = 0.;         // probability of a burst starting in a second
+    uint64_t burst_length = 10;     // seconds
+    double burst_share = 0.2;       // part of the events going to the burst key
+    uint64_t drift_interval = 0;    // seconds between popularity shifts, 0 for none
+    uint64_t drift = 1000;          // ranks the popularity shifts by
+    uint64_t seed = 1;
+
+    // "name=value,..." with the names of the fields above, std::invalid_argument on error
+    void Parse( const string &spec )
+    {
+        istringstream items( spec );
+        string item;
+        while( getline( items, item, ',' ) )
+        {
+            const size_t eq = item.find( '=' );
+            if (eq == string::npos)
+                throw invalid_argument( "generator: name=value expected: " + item );
+            Set( item.substr( 0, eq ), item.substr( eq + 1 ) );
+        }
+        if (!keys || !rate || !clients || !burst_length)
+            throw invalid_argument( "generator: keys, rate, clients and burst_length must be positive" );
+    }
+
+private:
+    void Set( const string &name, const string &value )
+    {
+        char *end;
+        const double number = strtod( value.c_str(), &end );
+        if (value.empty() || *end)
+            throw invalid_argument( "generator: number expected: " + name + "=" + value );
+
+        if (name == "events") events = number;
+        else if (name == "keys") keys = number;
+        else if (name == "zipf") zipf = number;
+        else if (name == "rate") rate = number;
+        else if (name == "start") start = number;
+        else if (name == "size_mu") size_mu = number;
+        else if (name == "size_sigma") size_sigma = number;
+        else if (name == "clients") clients = number;
+        else if (name == "client_zipf") client_zipf = number;
+        else if (name == "burst_rate") burst_rate = number;
+        else if (name == "burst_length") burst_length = number;
+        else if (name == "burst_share") burst_share = number;
+        else if (name == "drift_interval") drift_interval = number;
+        else if (name == "drift") drift = number;
+        else if (name == "seed") seed = number;
+        else throw invalid_argument( "generator: unknown parameter " + name );
+    }
+};
+
+// Generates a reproducible stream of events and notifies observers as EventParser does.
+// Randomness comes from splitmix64 and distributions are computed here, so a config and
+// seed give the same stream with any compiler and library.
+//
+// Key ranks are Zipf distributed; every drift_interval seconds the rank to key mapping
+// is rotated by drift, so hot keys change over time. A burst makes one random key take
+// burst_share of the events for burst_length seconds. A key reads the same lognormal
+// size every time, derived from the key itself.
+class EventGenerator : public Observable
+{
+    // Zipf distribution over [0, n) by inversion of the precomputed CDF
+    class Zipf
+    {
+    public:
+        Zipf( uint64_t n, double s )
+        : cdf_( n )
+        {
+            double sum = 0.;
+            for(uint64_t i = 0; i < n; ++i)
+            {
+                sum += 1. / pow( double(i + 1), s );
+                cdf_[i] = sum;
+            }
+            for( auto &c : cdf_ )
+            {
+                c /= sum;
+            }
+        }
+
+        uint64_t operator ()( double u ) const
+        {
+            const size_t i = lower_bound( cdf_.begin(), cdf_.end(), u ) - cdf_.begin();
+            return min( i, cdf_.size() - 1 );
+        }
+
+    private:
+        vector<double> cdf_;
+    };
+
+    enum { BATCH_SIZE = 256 };
+
+public:
+    EventGenerator( const GeneratorConfig &config )
+    : config_( config ),
+     keys_( config.keys, config.zipf ),
+     clients_( config.clients, config.client_zipf ),
+     state_( config.seed ),
+     key_ids_( config.keys, NoId() ),
+     client_ids_( config.clients, NoId() )
+    {}
+
+    void Generate()
+    {
+        uint64_t shift = 0;
+        uint64_t burst_key = 0, burst_end = 0;
+        uint64_t generated = 0;
+        for(uint64_t second = 0; generated < config_.events; ++second)
+        {
+            if (config_.drift_interval && second && second % config_.drift_interval == 0)
+                shift = (shift + config_.drift) % config_.keys;
+
+            if (second >= burst_end && Uniform() < config_.burst_rate)
+            {
+                burst_key = Next() % config_.keys;
+                burst_end = second + config_.burst_length;
+            }
+
+            const uint64_t count = min( config_.rate, config_.events - generated );
+            for(uint64_t i = 0; i < count; ++i)
+            {
+                uint64_t key;
+                if (second < burst_end && Uniform() < config_.burst_share)
+                    key = burst_key;
+                else
+                    key = (keys_( Uniform() ) + shift) % config_.keys;
+
+                Event event;
+                event.time = config_.start + second;
+                // interned in the order of EventParser, ids of a CSV replay are the same
+                event.request = ClientId( clients_( Uniform() ) );
+                event.key = KeyId( key );
+                event.size = KeySize( key );
+                event.freq = 1;
+                event.freq_double = 1.;
+                Notify( event );
+            }
+            generated += count;
+        }
+        Flush();
+    }
+
+private:
+    // marks strings not interned yet
+    static Event::id_type NoId() { return ~Event::id_type(0); }
+
+    // splitmix64
+    uint64_t Next()
+    {
+        state_ += 0x9e3779b97f4a7c15ULL;
+        return mix_id( state_ );
+    }
+
+    // in (0, 1)
+    double Uniform()
+    {
+        return ((Next() >> 11) + 0.5) / 9007199254740992.;
+    }
+
+    // 40 hex digits, as Elliptics ids in the logs
+    Event::id_type KeyId( uint64_t key )
+    {
+        if (key_ids_[key] == NoId())
+        {
+            char name[41];
+            const uint64_t base = mix_id( key ^ mix_id( config_.seed ) );
+            uint64_t h = 0;
+            for(int i = 0; i < 40; ++i)
+            {
+                if (i % 16 == 0)
+                    h = mix_id( base + i );
+                name[i] = "0123456789abcdef"[h & 15];
+                h >>= 4;
+            }
+            key_ids_[key] = Strings().intern( name, 40 );
+        }
+        return key_ids_[key];
+    }
+
+    // client address, as EventParser leaves of the request field
+    Event::id_type ClientId( uint64_t client )
+    {
+        if (client_ids_[client] == NoId())
+        {
+            char name[64];
+            const int len = snprintf( name, sizeof(name), "10.0.%d.%d:%d",
+                                      int(client / 250), int(client % 250), int(1000 + client % 1000) );
+            client_ids_[client] = Strings().intern( name, len );
+        }
+        return client_ids_[client];
+    }
+
+    // lognormal by Box-Muller over two hashes of the key
+    uint64_t KeySize( uint64_t key ) const
+    {
+        const double u1 = ((mix_id( key * 2 + 1 ) >> 11) + 0.5) / 9007199254740992.;
+        const double u2 = ((mix_id( key * 2 + 2 ) >> 11) + 0.5) / 9007199254740992.;
+        const double normal = sqrt( -2. * log( u1 ) ) * cos( 2. * 3.14159265358979323846 * u2 );
+        return max( 1., exp( config_.size_mu + config_.size_sigma * normal ) );
+    }
+
+    // Events are passed to observers in batches of BATCH_SIZE
+    void Notify( const Event &event )
+    {
+        batch_.push_back( event );
+        if (batch_.size() == BATCH_SIZE)
+            Flush();
+    }
+
+    void Flush()
+    {
+        if (!batch_.empty())
+        {
+            NotifyBatch( &batch_[0], batch_.size() );
+            batch_.clear();
+        }
+    }
+
+private:
+    GeneratorConfig config_;
+    Zipf keys_, clients_;
+    uint64_t state_;
+    vector<Event::id_type> key_ids_, client_ids_;
+    vector<Event> batch_;
+};
+
+#endif // EVENT_GENERATOR_HPP
@@ -0,0 +1,136 @@
+#ifndef EVENT_LOG_FORMAT_HPP
+#define EVENT_LOG_FORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Binary columnar event log.
+//
+//   magic "ELTOPEV\0", uint32 version, uint32 reserved (little-endian)
+//   blocks up to the end of the file, each of them:
+//     varint number of events
+//     request dictionary: varint count, then varint length and bytes of every string
+//     key dictionary:     the same
+//     varint byte length of each of the four columns, then the columns themselves:
+//       time     zigzag varint of the first time, then zigzag varint deltas
+//       request  varint index in the request dictionary of the block
+//       key      varint index in the key dictionary of the block
+//       size     varint
+//
+// A block is written once it holds block_events events, so the writer keeps a block in
+// memory rather than the whole log. Columns of a block are stored one after another,
+// so a reader keeps four cursors and decodes an event with four varint reads and no
+// string handling. Version 1 is a log of exactly one block.
+namespace event_log {
+
+static const char magic[8] = { 'E', 'L', 'T', 'O', 'P', 'E', 'V', '\0' };
+static const uint32_t version = 2;
+static const size_t block_events = 1 << 18;
+static const size_t header_size = sizeof(magic) + 2 * sizeof(uint32_t);
+
+inline bool has_magic(const char *data, size_t size) {
+	return size >= header_size && !memcmp(data, magic, sizeof(magic));
+}
+
+inline void put_varint(std::string &out, uint64_t value) {
+	while (value >= 0x80) {
+		out += static_cast<char>(value | 0x80);
+		value >>= 7;
+	}
+	out += static_cast<char>(value);
+}
+
+inline uint64_t zigzag(int64_t value) {
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void put_uint32(std::string &out, uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		out += static_cast<char>(value >> (8 * i));
+	}
+}
+
+inline void put_uint64(std::string &out, uint64_t value) {
+	for (int i = 0; i < 8; ++i) {
+		out += static_cast<char>(value >> (8 * i));
+	}
+}
+
+// Bounds checked reader over a part of the mapped log
+class cursor {
+
+public:
+	cursor(const char *begin, const char *end): p(reinterpret_cast<const unsigned char *>(begin)),
+		end(reinterpret_cast<const unsigned char *>(end)) {
+	}
+
+	uint64_t varint() {
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (p == end) {
+				throw std::runtime_error("event log: unexpected end of data");
+			}
+			const unsigned char byte = *p++;
+			value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return value;
+			}
+		}
+		throw std::runtime_error("event log: malformed varint");
+	}
+
+	uint32_t uint32() {
+		if (end - p < 4) {
+			throw std::runtime_error("event log: unexpected end of data");
+		}
+		uint32_t value = 0;
+		for (int i = 0; i < 4; ++i) {
+			value |= static_cast<uint32_t>(*p++) << (8 * i);
+		}
+		return value;
+	}
+
+	uint64_t uint64() {
+		if (end - p < 8) {
+			throw std::runtime_error("event log: unexpected end of data");
+		}
+		uint64_t value = 0;
+		for (int i = 0; i < 8; ++i) {
+			value |= static_cast<uint64_t>(*p++) << (8 * i);
+		}
+		return value;
+	}
+
+	// next n bytes, the cursor moves past them
+	const char *bytes(size_t n) {
+		if (static_cast<size_t>(end - p) < n) {
+			throw std::runtime_error("event log: unexpected end of data");
+		}
+		const char *data = reinterpret_cast<const char *>(p);
+		p += n;
+		return data;
+	}
+
+	const char *position() const {
+		return reinterpret_cast<const char *>(p);
+	}
+
+	bool at_end() const {
+		return p == end;
+	}
+
+private:
+	const unsigned char *p;
+	const unsigned char *end;
+};
+
+} // namespace event_log
+
+#endif // EVENT_LOG_FORMAT_HPP
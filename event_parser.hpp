@@ -0,0 +1,584 @@
+#ifndef EVENT_PARSER_HPP
+#define EVENT_PARSER_HPP
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <limits>
+#include "event.hpp"
+#include "observer.hpp"
+#include "string_table.hpp"
+#include "mapped_file.hpp"
+#include "timestamp_decoder.hpp"
+#include "gz_line_reader.hpp"
+#include "event_log_format.hpp"
+
+class EventParser : public Observable
+{
+    // Field of a line, points into the mapped file and is not null-terminated
+    struct Field
+    {
+        const char *data;
+        size_t size;
+    };
+
+    // Parsed line, request and key are not interned yet
+    struct Line
+    {
+        time_t time;
+        Field request;
+        Field key;
+        uint64_t size;
+    };
+
+    // Lines of one byte range of the file, parsed by a worker thread
+    struct Chunk
+    {
+        vector<Line> lines;
+        const char *error, *error_end; // malformed line that stopped parsing, if any
+    };
+
+    typedef vector< future<Chunk> > Batch;
+
+    enum { NUM_FIELDS = 4 };
+    enum { CHUNK_SIZE = 8 << 20 };
+    enum { BATCH_SIZE = 256 };
+
+public:
+    // "local" (default), "utc" or a fixed offset like "+0300", see timestamp_decoder::set_zone
+    bool SetTimeZone(const string &zone)
+    {
+        return timestamps_.set_zone( zone );
+    }
+
+    void Parse(const char *file_name)
+    {
+        mapped_file file(file_name);
+        if (event_log::has_magic( file.data(), file.size() ))
+            return ParseEventLog( file.data(), file.size() );
+
+        unsigned line_num = 0;
+        const char *error_end;
+        const char *error = ParseLines( file.data(), file.data() + file.size(), timestamps_, error_end,
+                                        [this, &line_num]( const Line &line ) { Emit( line ); ++line_num; } );
+        Flush();
+        if (error)
+            ReportError( line_num, error, error_end );
+    }
+
+    // Splits the file into line-aligned chunks which are parsed by num_threads threads,
+    // a batch of num_threads chunks at a time. Lines of a batch are merged by time and
+    // notified from the calling thread while the next batch is being parsed.
+    void ParseParallel(const char *file_name, size_t num_threads)
+    {
+        mapped_file file(file_name);
+        if (event_log::has_magic( file.data(), file.size() ))
+            return ParseEventLog( file.data(), file.size() );
+
+        const char *p = file.data();
+        const char *end = p + file.size();
+        unsigned line_num = 0;
+
+        Batch pending = LaunchBatch( p, end, num_threads );
+        while( !pending.empty() )
+        {
+            vector<Chunk> chunks;
+            for( auto &f : pending )
+            {
+                chunks.push_back( f.get() );
+            }
+
+            // stop after a malformed line, as the serial parser does
+            size_t num_chunks = chunks.size();
+            for(size_t i = 0; i < chunks.size(); ++i)
+            {
+                if (chunks[i].error)
+                {
+                    num_chunks = i + 1;
+                    break;
+                }
+            }
+
+            if (num_chunks == chunks.size())
+                pending = LaunchBatch( p, end, num_threads );
+            else
+                pending.clear();
+
+            line_num += MergeChunks( chunks, num_chunks );
+
+            const Chunk &last = chunks[num_chunks - 1];
+            if (last.error)
+            {
+                Flush();
+                ReportError( line_num, last.error, last.error_end );
+                break;
+            }
+        }
+        Flush();
+    }
+
+    // Replays several inputs at once, each of them already ordered by time, merging them by time
+    // with a heap over the current line of every input. Memory stays at one read buffer per input.
+    // Inputs are CSV files or, with node_logs, "READ: client" lines of Elliptics node logs,
+    // gzip compressed or plain.
+    void ParseMerged(const vector<const char *> &file_names, bool node_logs)
+    {
+        vector< unique_ptr<LineSource> > sources;
+        for( auto file_name : file_names )
+        {
+            sources.emplace_back( new LineSource( file_name, node_logs, timestamps_ ) );
+        }
+
+        typedef pair<time_t, size_t> HeapItem; // time of the current line, source
+        vector<HeapItem> heap;
+        for(size_t i = 0; i < sources.size(); ++i)
+        {
+            if (sources[i]->Next())
+                heap.push_back( HeapItem( sources[i]->Current().time, i ) );
+            else if (sources[i]->Failed())
+                return sources[i]->ReportError();
+        }
+        make_heap( heap.begin(), heap.end(), greater<HeapItem>() );
+
+        while( !heap.empty() )
+        {
+            pop_heap( heap.begin(), heap.end(), greater<HeapItem>() );
+            const size_t i = heap.back().second;
+            heap.pop_back();
+
+            LineSource &source = *sources[i];
+            Emit( source.Current() );
+
+            if (source.Next())
+            {
+                heap.push_back( HeapItem( source.Current().time, i ) );
+                push_heap( heap.begin(), heap.end(), greater<HeapItem>() );
+            }
+            else if (source.Failed())
+            {
+                Flush();
+                return source.ReportError();
+            }
+        }
+        Flush();
+    }
+
+    // Parses the complete lines of [data, data + size) as they come from a followed log: CSV
+    // lines or, with node_log, "READ: client" lines of an Elliptics node log. A malformed line
+    // is reported and skipped, a live log may hold a line torn by a crash of its writer.
+    void ParseText(const char *data, size_t size, bool node_log)
+    {
+        const char *p = data, *end = data + size;
+        string csv;
+        while( p < end )
+        {
+            const char *eol = static_cast<const char *>( memchr( p, '\n', end - p ) );
+            if (!eol)
+                eol = end;
+
+            const char *text = p;
+            size_t len = eol - p;
+            p = eol + 1;
+            if (node_log)
+            {
+                if (!ExtractReadLine( text, len, csv ))
+                    continue;
+                text = csv.data();
+                len = csv.size();
+            }
+
+            const char *error_end;
+            const char *error = ParseLines( text, text + len, timestamps_, error_end,
+                                            [this]( const Line &line ) { Emit( line ); } );
+            if (error)
+                cerr << "failed parse line: " << string( error, error_end ) << endl;
+        }
+        Flush();
+    }
+
+private:
+    // Replays a binary event log written by EventLogWriter
+    void ParseEventLog( const char *data, size_t size )
+    {
+        event_log::cursor cursor( data, data + size );
+        cursor.bytes( sizeof(event_log::magic) );
+        const uint32_t version = cursor.uint32();
+        if (version < 1 || version > event_log::version)
+            throw runtime_error( "event log: unsupported version " + to_string( version ) );
+        cursor.uint32();
+
+        // version 1 is a single block, which may be empty
+        vector<Event::id_type> requests, keys;
+        if (version == 1)
+            ParseEventBlock( cursor, requests, keys );
+        while( !cursor.at_end() )
+        {
+            ParseEventBlock( cursor, requests, keys );
+        }
+        Flush();
+    }
+
+    // Replays the block at cursor and moves past it
+    void ParseEventBlock( event_log::cursor &block, vector<Event::id_type> &requests, vector<Event::id_type> &keys )
+    {
+        const uint64_t num_events = block.varint();
+        requests.clear();
+        keys.clear();
+        ReadDictionary( block, requests );
+        ReadDictionary( block, keys );
+
+        uint64_t column_size[4];
+        for( auto &s : column_size )
+        {
+            s = block.varint();
+        }
+        const char *column = block.position();
+        event_log::cursor times( column, column + column_size[0] );
+        block.bytes( column_size[0] );
+        column = block.position();
+        event_log::cursor request_column( column, column + column_size[1] );
+        block.bytes( column_size[1] );
+        column = block.position();
+        event_log::cursor key_column( column, column + column_size[2] );
+        block.bytes( column_size[2] );
+        column = block.position();
+        event_log::cursor sizes( column, column + column_size[3] );
+        block.bytes( column_size[3] );
+
+        Event event;
+        event.time = 0;
+        event.freq = 1;
+        event.freq_double = 1.;
+        for(uint64_t i = 0; i < num_events; ++i)
+        {
+            event.time += event_log::unzigzag( times.varint() );
+            event.request = DictionaryId( requests, request_column.varint() );
+            event.key = DictionaryId( keys, key_column.varint() );
+            event.size = sizes.varint();
+            Notify( event );
+        }
+    }
+
+    // Interns dictionary strings, ids[i] becomes the id of the i-th string
+    static void ReadDictionary( event_log::cursor &cursor, vector<Event::id_type> &ids )
+    {
+        const uint64_t count = cursor.varint();
+        ids.reserve( count );
+        for(uint64_t i = 0; i < count; ++i)
+        {
+            const uint64_t len = cursor.varint();
+            ids.push_back( Strings().intern( cursor.bytes( len ), len ) );
+        }
+    }
+
+    static Event::id_type DictionaryId( const vector<Event::id_type> &ids, uint64_t index )
+    {
+        if (index >= ids.size())
+            throw runtime_error( "event log: dictionary index out of range" );
+        return ids[index];
+    }
+
+    // Input read line by line through gz_line_reader
+    class LineSource
+    {
+    public:
+        LineSource(const char *file_name, bool node_log, const timestamp_decoder &timestamps)
+        : reader_( file_name ),
+         node_log_( node_log ),
+         timestamps_( timestamps ),
+         line_num_( 0 ),
+         failed_( false )
+        {}
+
+        // Moves to the next line, returns false at the end of input or on a malformed line
+        bool Next()
+        {
+            const char *text;
+            size_t len;
+            while( reader_.next( text, len ) )
+            {
+                ++line_num_;
+                if (node_log_)
+                {
+                    if (!ExtractReadLine( text, len, csv_ ))
+                        continue;
+                    text = csv_.data();
+                    len = csv_.size();
+                }
+
+                const char *error_end;
+                const char *error = ParseLines( text, text + len, timestamps_, error_end,
+                                                [this]( const Line &line ) { line_ = line; } );
+                if (error)
+                {
+                    error_ = string( error, error_end );
+                    failed_ = true;
+                    return false;
+                }
+                return true;
+            }
+            return false;
+        }
+
+        // Valid until the next call of Next
+        const Line &Current() const { return line_; }
+
+        bool Failed() const { return failed_; }
+
+        void ReportError() const
+        {
+            cerr << reader_.file_name() << ": ";
+            EventParser::ReportError( line_num_ - 1, error_.data(), error_.data() + error_.size() );
+        }
+
+    private:
+        gz_line_reader reader_;
+        bool node_log_;
+        timestamp_decoder timestamps_;
+        unsigned line_num_;
+        string csv_;
+        Line line_;
+        bool failed_;
+        string error_;
+    };
+
+    // Converts a node log line into a CSV line, returns false if it is not a read request:
+    //   zfgrep 'READ: client' | cut -d" " -f 1,2,5,20   (extract_*_node_read.sh)
+    //   sed 's/[\/][0-9]*\,$//'                       (erase_last_slash.sh)
+    //   awk '{print $1 " " $2 "," $3 "," $4 "," $5}'   (to_csv.sh)
+    static bool ExtractReadLine( const char *line, size_t len, string &csv )
+    {
+        static const char marker[] = "READ: client";
+        if (!memmem( line, len, marker, sizeof(marker) - 1 ))
+            return false;
+
+        static const int field_numbers[] = { 1, 2, 5, 20 };
+        const int num_fields = sizeof(field_numbers) / sizeof(field_numbers[0]);
+        Field fields[num_fields];
+        int found = 0;
+        const char *p = line, *end = line + len;
+        for(int field_num = 1; found < num_fields && p <= end; ++field_num)
+        {
+            const char *space = static_cast<const char *>( memchr( p, ' ', end - p ) );
+            if (!space)
+                space = end;
+            if (field_num == field_numbers[found])
+                fields[found++] = Field{ p, static_cast<size_t>(space - p) };
+            p = space + 1;
+        }
+        if (found < num_fields)
+            return false;
+
+        Field &last = fields[num_fields - 1];
+        if (last.size && last.data[last.size - 1] == ',')
+        {
+            size_t i = last.size - 1;
+            while( i > 0 && isdigit( last.data[i - 1] ) )
+                --i;
+            if (i > 0 && last.data[i - 1] == '/')
+                last.size = i - 1;
+        }
+
+        csv.assign( fields[0].data, fields[0].size );
+        csv += ' ';
+        csv.append( fields[1].data, fields[1].size );
+        for(int i = 2; i < num_fields; ++i)
+        {
+            csv += ',';
+            csv.append( fields[i].data, fields[i].size );
+        }
+        return true;
+    }
+
+    // Starts parsing of up to num_threads line-aligned chunks of about CHUNK_SIZE bytes from p
+    // on their own threads, moves p past the last one
+    Batch LaunchBatch( const char *&p, const char *end, size_t num_threads ) const
+    {
+        Batch batch;
+        for(size_t i = 0; i < num_threads && p < end; ++i)
+        {
+            const char *chunk_end = end;
+            if (end - p > CHUNK_SIZE)
+            {
+                chunk_end = static_cast<const char *>( memchr( p + CHUNK_SIZE, '\n', end - p - CHUNK_SIZE ) );
+                chunk_end = chunk_end ? chunk_end + 1 : end;
+            }
+            batch.push_back( async( launch::async, &EventParser::ParseChunk, p, chunk_end, timestamps_ ) );
+            p = chunk_end;
+        }
+        return batch;
+    }
+
+    void Emit( const Line &line )
+    {
+        string_table &strings = Strings();
+
+        Event event;
+        event.time = line.time;
+        event.request = strings.intern( line.request.data, line.request.size );
+        event.key = strings.intern( line.key.data, line.key.size );
+        event.size = line.size;
+        event.freq = 1;
+        event.freq_double = 1.;
+        Notify( event );
+    }
+
+    // Events are passed to observers in batches of BATCH_SIZE
+    void Notify( const Event &event )
+    {
+        batch_.push_back( event );
+        if (batch_.size() == BATCH_SIZE)
+            Flush();
+    }
+
+    void Flush()
+    {
+        if (!batch_.empty())
+        {
+            NotifyBatch( &batch_[0], batch_.size() );
+            batch_.clear();
+        }
+    }
+
+    static void ReportError( unsigned line_num, const char *line, const char *line_end )
+    {
+        cerr << "failed parse line: " << line_num << ": " << string(line, line_end) << endl;
+    }
+
+    // Notifies lines of chunks [0, num_chunks) in time order, lines of equal time keep the file order.
+    // Returns the number of lines notified.
+    unsigned MergeChunks( const vector<Chunk> &chunks, size_t num_chunks )
+    {
+        typedef pair<time_t, size_t> HeapItem; // time of the next line, chunk
+        vector<HeapItem> heap;
+        vector<size_t> pos( num_chunks, 0 );
+        unsigned num_lines = 0;
+
+        for(size_t i = 0; i < num_chunks; ++i)
+        {
+            if (!chunks[i].lines.empty())
+                heap.push_back( HeapItem( chunks[i].lines[0].time, i ) );
+        }
+        make_heap( heap.begin(), heap.end(), greater<HeapItem>() );
+
+        while( !heap.empty() )
+        {
+            pop_heap( heap.begin(), heap.end(), greater<HeapItem>() );
+            const size_t i = heap.back().second;
+            heap.pop_back();
+
+            const vector<Line> &lines = chunks[i].lines;
+            Emit( lines[pos[i]++] );
+            ++num_lines;
+
+            if (pos[i] < lines.size())
+            {
+                heap.push_back( HeapItem( lines[pos[i]].time, i ) );
+                push_heap( heap.begin(), heap.end(), greater<HeapItem>() );
+            }
+        }
+        return num_lines;
+    }
+
+    static Chunk ParseChunk( const char *begin, const char *end, timestamp_decoder timestamps )
+    {
+        Chunk chunk;
+        chunk.lines.reserve( (end - begin) / 64 );
+        chunk.error = ParseLines( begin, end, timestamps, chunk.error_end,
+                                  [&chunk]( const Line &line ) { chunk.lines.push_back( line ); } );
+        return chunk;
+    }
+
+    // Parses lines of [p, end) passing each one to handler. Stops at the first malformed line
+    // and returns its start (and end in error_end), returns null if all lines were parsed.
+    template<typename Handler>
+    static const char *ParseLines( const char *p, const char *end, timestamp_decoder &timestamps,
+                                   const char *&error_end, Handler handler )
+    {
+        Line line;
+        while( p < end )
+        {
+            const char *eol = static_cast<const char *>( memchr( p, '\n', end - p ) );
+            if (!eol)
+                eol = end;
+
+            Field fields[NUM_FIELDS];
+            int tok_number = SplitLine( p, eol, fields );
+
+            bool parsed = tok_number == NUM_FIELDS;
+            if ( parsed ) {
+                line.time = timestamps.decode( fields[0].data, fields[0].size );
+
+                const Field &r = fields[1];
+                const char *slash = static_cast<const char *>( memchr( r.data, '/', r.size ) );
+                line.request = Field{ r.data, slash ? static_cast<size_t>(slash - r.data) : 0 };
+
+                line.key = fields[2];
+
+                parsed = ParseSize( fields[3], line.size );
+            }
+
+            if ( !parsed ) {
+                error_end = eol;
+                return p;
+            }
+
+            handler( line );
+            p = eol + 1;
+        }
+        return nullptr;
+    }
+
+    // Splits [begin, end) by commas skipping empty fields, returns the number of fields found
+    static int SplitLine( const char *begin, const char *end, Field *fields )
+    {
+        int tok_number = 0;
+        while( begin < end )
+        {
+            const char *comma = static_cast<const char *>( memchr( begin, ',', end - begin ) );
+            if (!comma)
+                comma = end;
+
+            if (comma != begin)
+            {
+                if (tok_number < NUM_FIELDS)
+                    fields[tok_number] = Field{ begin, static_cast<size_t>(comma - begin) };
+                ++tok_number;
+            }
+            begin = comma + 1;
+        }
+        return tok_number;
+    }
+
+    // Decimal size, the last field of a line, so a CRLF line ending leaves '\r' after it
+    static bool ParseSize( const Field &t, uint64_t &size )
+    {
+        size_t len = t.size;
+        if (len && t.data[len - 1] == '\r')
+            --len;
+        if (!len)
+            return false;
+
+        size = 0;
+        for(size_t i = 0; i < len; ++i)
+        {
+            const unsigned digit = t.data[i] - '0';
+            if (digit > 9 || size > (numeric_limits<uint64_t>::max() - digit) / 10)
+                return false;
+            size = size * 10 + digit;
+        }
+        return true;
+    }
+
+private:
+    timestamp_decoder timestamps_;
+    vector<Event> batch_;
+};
+
+#endif // EVENT_PARSER_HPP
@@ -2,40 +2,65 @@
 #define EVENT_STATS_HPP
 
 #include <algorithm>
-#include <functional> // not1
+#include <functional> // not1, function
 #include <vector>
 #include <list>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <cmath>
 #include "treap.hpp"
+#include "indexed_heap.hpp"
+#include "object_pool.hpp"
+#include "count_min_sketch.hpp"
 
 #include <iostream>
 
 using namespace std;
 
-//#define TOP_SIMPLE
-//#define TOP_SLICES
-#define TOP_LRU
+// Strategies of event_stats: top_simple, top_slices, top_lru and top_space_saving.
+// All of them share the same interface, event_stats<E> at the end of the file wraps one
+// chosen at runtime by name.
 
-#ifdef TOP_SIMPLE
-// Simple event_stats implementation, used for ADT interface specification.
+// Simple event_stats strategy, used for ADT interface specification.
 // May be used as reference impl.
 template<typename E>
-class event_stats
+class top_simple
 {
     typedef std::vector<E> Container;
 public:
-    event_stats(size_t events_limit, size_t top_k, int period_in_seconds)
+    // every event is kept, so any period up to period_in_seconds can be answered
+    top_simple(size_t events_limit, size_t top_k, int period_in_seconds,
+               const std::vector<int> &windows_in_seconds = std::vector<int>())
     : period(period_in_seconds)
     {
     }
 
+    // top_freq is ordered by freq
+    enum { FREQ_BY_DOUBLE = 0 };
+
     void add_event(const E &event, time_t time)
     {
         events.push_back(event);
     }
 
+    // adds events with their own time
+    void add_events(const E *events, size_t count)
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            add_event( events[i], events[i].time );
+        }
+    }
+
+    // the reference keeps every event, there is nothing to maintain
+    void tick(time_t time)
+    {
+    }
+
     template< typename ResultContainer >
     void get_top(size_t k, int period_in_seconds, time_t time, ResultContainer &top_size, ResultContainer &top_freq) const
     {
@@ -44,11 +69,11 @@ public:
         typedef std::set<E> SetT;
         SetT last_events;
 
-        typedef std::unordered_set<string> RequestSetT;
+        typedef std::unordered_set< decltype(E::request) > RequestSetT;
         RequestSetT requests;
 
         typename Container::const_iterator it;
-        E e{time - period, "", "", 0, 0, 0.};
+        E e{time - period, 0, 0, 0, 0, 0.};
         it = lower_bound( events.begin(), events.end(), e, &E::time_compare );
 
         requests.reserve( std::distance(it, events.end()) );
@@ -88,15 +113,34 @@ public:
         top_freq.resize(k);
     }
 
+    // state for snapshots: all events, in time order; values are exact, there are no errors
+    template< typename ResultContainer >
+    void export_items(ResultContainer &items, ResultContainer &errors) const
+    {
+        items.insert( items.end(), events.begin(), events.end() );
+    }
+
+    void import_items(const E *items, const E *errors, size_t count)
+    {
+        events.insert( events.end(), items, items + count );
+        stable_sort( events.begin(), events.end(), &E::time_compare );
+    }
+
+    // calls f for every item held, which covers every key and request referred to
+    template< typename F >
+    void for_each_item(F f) const
+    {
+        for( const auto &e : events )
+            f( e );
+    }
+
 private:
     int period;
     Container events;
 };
-#endif // TOP_SIMPLE
 
-#ifdef TOP_SLICES
 template<typename E>
-class event_stats
+class top_slices
 {
     struct TopSlice
     {
@@ -115,53 +159,50 @@ class event_stats
     };
 
 public:
-    event_stats(size_t events_limit, size_t top_k_, int period_in_seconds)
+    // a slice covers a second, so any period up to period_in_seconds can be answered
+    top_slices(size_t events_limit, size_t top_k_, int period_in_seconds,
+               const std::vector<int> &windows_in_seconds = std::vector<int>())
     : num_events(0),
      max_events(events_limit),
      top_k(top_k_),
      period(period_in_seconds),
      events( new E[events_limit] ),
      num_slices(0),
-     slice_head(nullptr), slice_tail(nullptr),
-     last_event_time(0)
+     slice_head(nullptr), slice_tail(nullptr)
     {
     }
 
+    // top_freq is ordered by freq
+    enum { FREQ_BY_DOUBLE = 0 };
+
+    // only buffers the event, slices are built by tick; a full buffer is turned into
+    // slices right away
     void add_event(const E &event, time_t time)
     {
-        if (num_events >= max_events ||
-           time - last_event_time >= 1 )
-        {
-            if (last_event_time)
-            {
-                on_timer_tick(time); // todo MT: send notification to periodic thread
-                num_events = 0;
-            }
-            last_event_time = time;
-        }
+        if (num_events >= max_events)
+            build_slices(num_events, time);
         events[num_events++] = event;
     }
 
-    void on_timer_tick(time_t time)
+    // adds events with their own time
+    void add_events(const E *events, size_t count)
     {
-        // todo MT: copy events array
-        erase_old_tops(time);
-
-        int second_start = 0;
-        time_t last_event_time = events[0].time;
-        for(int i = 0; i < num_events; ++i)
+        for(size_t i = 0; i < count; ++i)
         {
-            if ( events[i].time - last_event_time >= 1 )
-            {
-                append_slice( build_top_slice(second_start, i, time) );
-                second_start = i;
-            }
+            add_event( events[i], events[i].time );
         }
+    }
 
-        if (second_start < num_events)
-        {
-            append_slice( build_top_slice( second_start, num_events, time ) );
-        }
+    // builds slices of the events buffered before time, a slice per second of them,
+    // and erases slices out of the period; get_top ticks itself, so ticks from a timer
+    // only move this work out of get_top
+    void tick(time_t time)
+    {
+        E *end = stable_partition( &events[0], &events[0] + num_events,
+                                   [time]( const E &e ) { return e.time < time; } );
+        if (end != &events[0])
+            build_slices(end - &events[0], time);
+        erase_old_tops(time);
     }
 
     template< typename ResultContainer >
@@ -169,16 +210,20 @@ public:
     {
         int period = min(this->period, period_in_seconds);
 
-        erase_old_tops(time);
+        tick(time);
 
         typedef std::set<E> SetT;
         SetT events_size, events_freq;
 
-        typedef std::unordered_set<string> RequestSetT;
+        typedef std::unordered_set< decltype(E::request) > RequestSetT;
         RequestSetT requests;
         requests.reserve( k * period );
 
         TopSlice *slice = slice_head;
+        while( slice && slice->time + period < time )
+        {
+            slice = slice->next;
+        }
         while( slice )
         {
             for(int i = 0; i < slice->k; ++i)
@@ -221,19 +266,67 @@ public:
             slice = slice->next;
         }
 
+        // the two sets have different sizes
         top_size = std::move( ResultContainer(events_size.begin(), events_size.end()) );
-        k = min(top_size.size(), k);
+        const size_t k_size = min(top_size.size(), k);
         std::function<decltype(E::size_compare)> comparator_size( &E::size_compare );
-        partial_sort(top_size.begin(), top_size.begin() + k, top_size.end(), std::not2(comparator_size) );
-        top_size.resize(k);
+        partial_sort(top_size.begin(), top_size.begin() + k_size, top_size.end(), std::not2(comparator_size) );
+        top_size.resize(k_size);
 
         top_freq = std::move( ResultContainer(events_freq.begin(), events_freq.end()) );
+        const size_t k_freq = min(top_freq.size(), k);
         std::function<decltype(E::freq_compare)> comparator_freq( &E::freq_compare );
-        partial_sort(top_freq.begin(), top_freq.begin() + k, top_freq.end(), std::not2(comparator_freq) );
-        top_freq.resize(k);
+        partial_sort(top_freq.begin(), top_freq.begin() + k_freq, top_freq.end(), std::not2(comparator_freq) );
+        top_freq.resize(k_freq);
+    }
+
+    template< typename ResultContainer >
+    void export_items(ResultContainer &items, ResultContainer &errors) const
+    {
+        throw std::logic_error("top_slices doesn't support snapshots");
+    }
+
+    void import_items(const E *items, const E *errors, size_t count)
+    {
+        throw std::logic_error("top_slices doesn't support snapshots");
+    }
+
+    // buffered events and the tops of every slice
+    template< typename F >
+    void for_each_item(F f) const
+    {
+        for(size_t i = 0; i < num_events; ++i)
+            f( events[i] );
+        for( const TopSlice *slice = slice_head; slice; slice = slice->next )
+        {
+            for(int i = 0; i < slice->k; ++i)
+            {
+                f( slice->top_size[i] );
+                f( slice->top_freq[i] );
+            }
+        }
     }
 
 private:
+    // turns the first count buffered events into slices stamped with time, keeps the rest
+    void build_slices(size_t count, time_t time)
+    {
+        size_t second_start = 0;
+        for(size_t i = 1; i < count; ++i)
+        {
+            if (events[i].time != events[second_start].time)
+            {
+                append_slice( build_top_slice(second_start, i, time) );
+                second_start = i;
+            }
+        }
+        if (second_start < count)
+            append_slice( build_top_slice(second_start, count, time) );
+
+        move( &events[0] + count, &events[0] + num_events, &events[0] );
+        num_events -= count;
+    }
+
     void erase_old_tops(time_t time)
     {
         TopSlice *slice = slice_head;
@@ -258,7 +351,7 @@ private:
         typedef std::set<E> SetT;
         SetT last_events;
 
-        typedef std::unordered_set<string> RequestSetT;
+        typedef std::unordered_set< decltype(E::request) > RequestSetT;
         RequestSetT requests;
         requests.reserve( end - start );
 
@@ -317,23 +410,24 @@ private:
     std::unique_ptr<E[]> events;
     int num_slices;
     TopSlice *slice_head, *slice_tail;
-    time_t last_event_time;
 };
-#endif // TOP_SLICES
 
-#ifdef TOP_LRU
 template<typename E>
 class node_t : public treap_node_t< node_t<E> >
 {
 public:
+    typedef decltype(E::key) key_type;
+
     node_t(const E &e) : item(e) {}
 
-    const char *key() const { return item.key.c_str(); }
+    key_type key() const { return item.key; }
 
     size_t eventtime() const { return item.time; }
 
     size_t get_size() const { return item.size; }
 
+    double get_freq() const { return item.freq_double; }
+
     const E &get_item() const { return item; }
 
     void update_size( time_t time, size_t window_size, size_t size )
@@ -342,10 +436,9 @@ public:
         item.size = delta * item.size + size;
     }
 
-    void check_expiration( time_t time, size_t window_size )
+    bool is_expired( time_t time, size_t window_size ) const
     {
-        if (time - item.time > window_size)
-            item.size = 0;
+        return time - item.time > static_cast<time_t>(window_size);
     }
 
     void update_time( time_t time )
@@ -359,100 +452,536 @@ public:
         item.freq_double = delta * item.freq_double + freq;
     }
 
-private:
-    inline double compute_delta( time_t current_time, time_t last_time, size_t window_size ) const
+    void set_values( uint64_t size, double freq )
+    {
+        item.size = size;
+        item.freq_double = freq;
+    }
+
+    // weight left of a value last updated at last_time, it decays linearly to zero over the window
+    static double compute_delta( time_t current_time, time_t last_time, size_t window_size )
     {
         double delta = 1. - (current_time - last_time) / (double)window_size;
         if (delta < 0.) delta = 0.;
         return delta;
     }
 
+    // positions in event_stats top-k heaps
+    size_t size_pos, freq_pos;
+
+    // landmark-relative values of exponential_decay
+    double size_score, freq_score;
+
 private:
     E item;
 };
 
+// Admission policies of top_lru, they decide whether a new key replaces the least recently
+// updated node of a full table. record is called for every event before admit.
 template<typename E>
-class event_stats
+class admit_all
+{
+public:
+    admit_all(size_t events_limit) {}
+
+    void record(const E &event) {}
+
+    bool admit(const E &victim) const { return true; }
+};
+
+// TinyLFU admission: count-min sketches of frequency and bytes, a new key gets in only
+// if it is estimated more frequent or heavier than the victim
+template<typename E>
+class sketch_admission
+{
+public:
+    sketch_admission(size_t events_limit)
+    : freq_sketch(2 * events_limit, 10 * events_limit),
+     size_sketch(2 * events_limit, 10 * events_limit),
+     freq_estimate(0),
+     size_estimate(0)
+    {}
+
+    void record(const E &event)
+    {
+        freq_estimate = freq_sketch.add( event.key, 1 );
+        size_estimate = size_sketch.add( event.key, event.size );
+    }
+
+    // the candidate is the last recorded event
+    bool admit(const E &victim) const
+    {
+        return freq_estimate > freq_sketch.estimate( victim.key ) ||
+            size_estimate > size_sketch.estimate( victim.key );
+    }
+
+private:
+    count_min_sketch< uint32_t > freq_sketch;
+    count_min_sketch< uint64_t > size_sketch;
+    uint64_t freq_estimate, size_estimate;
+};
+
+// Decay policies of top_lru: how the values of a node age between the events of its key,
+// and the keys the heaps order nodes by.
+//
+// linear_decay: a value loses 1/period of itself per second since the last event of the
+// key (node_t::compute_delta), so it falls to zero at the end of the period. Values are kept
+// as of the last event of each node, so the heaps compare values of different ages.
+template<typename E>
+class linear_decay
+{
+public:
+    typedef node_t<E> node_type;
+
+    linear_decay(int period_in_seconds) : period(period_in_seconds) {}
+
+    // every event, before anything else; decay is relative to the time of each node
+    template< typename Nodes >
+    void advance(time_t time, Nodes &nodes) {}
+
+    // a new node, its item values are as of its time
+    void init(node_type *n) {}
+
+    // an event of the node's key, before the time of the node is updated
+    void add(node_type *n, time_t time, size_t size)
+    {
+        n->update_size( time, period, size );
+        n->update_freq( time, period, 1. );
+    }
+
+    static double size_key(const node_type *n) { return n->get_size(); }
+    static double freq_key(const node_type *n) { return n->get_freq(); }
+
+    // item of the node for get_top as of time
+    E item(const node_type *n, time_t time) const { return n->get_item(); }
+
+private:
+    int period;
+};
+
+// exponential_decay: forward decay (Cormode, Shkapenyuk, Srivastava, Xu). An event at t adds
+// its value times g(t) = exp(rate * (t - landmark)) to the score of its key, and the value of
+// a key at time now is its score / g(now). All scores are relative to the same landmark, so
+// they are never rescaled as time passes: their order is the order of the decayed values at
+// any time, an event changes the score of its own key only, in O(1) and one heap update,
+// and the heaps stay valid across ticks without touching the other nodes.
+// rate is 2 / period, which gives an event the same total weight as linear_decay over the
+// period; a key not seen for the period is at exp(-2) of its value when it expires.
+// The landmark is moved forward only when g would pass exp(MAX_EXPONENT), scaling all
+// scores by the same factor, which keeps their order and the heaps as they are.
+template<typename E>
+class exponential_decay
 {
-    typedef treap< node_t<E> > treap_t;
 public:
-    event_stats(size_t events_limit, size_t top_k, int period_in_seconds)
+    typedef node_t<E> node_type;
+
+    exponential_decay(int period_in_seconds)
+    : rate(2. / period_in_seconds),
+     landmark(0)
+    {}
+
+    template< typename Nodes >
+    void advance(time_t time, Nodes &nodes)
+    {
+        if (!landmark)
+            landmark = time;
+        if (rate * (time - landmark) <= MAX_EXPONENT)
+            return;
+
+        const double scale = 1. / weight( time );
+        nodes.for_each( [scale]( node_type *n )
+                        {
+                            n->size_score *= scale;
+                            n->freq_score *= scale;
+                        } );
+        landmark = time;
+    }
+
+    void init(node_type *n)
+    {
+        const double g = weight( n->eventtime() );
+        n->size_score = n->get_size() * g;
+        n->freq_score = n->get_freq() * g;
+    }
+
+    // item values are kept as of the last event too, for snapshots
+    void add(node_type *n, time_t time, size_t size)
+    {
+        const double g = weight( time );
+        n->size_score += size * g;
+        n->freq_score += g;
+        n->set_values( n->size_score / g + .5, n->freq_score / g );
+    }
+
+    static double size_key(const node_type *n) { return n->size_score; }
+    static double freq_key(const node_type *n) { return n->freq_score; }
+
+    E item(const node_type *n, time_t time) const
+    {
+        const double g = weight( time );
+        E item( n->get_item() );
+        item.size = n->size_score / g + .5;
+        item.freq_double = n->freq_score / g;
+        return item;
+    }
+
+private:
+    enum { MAX_EXPONENT = 64 };
+
+    double weight(time_t time) const
+    {
+        return exp( rate * (time - landmark) );
+    }
+
+private:
+    double rate;
+    time_t landmark;
+};
+
+// Nodes are kept in three structures at once: the treap, ordered by last event time
+// (used for LRU eviction and lazy expiration from the top), and two indexed heaps,
+// ordered by size and by frequency, from which get_top takes k nodes in O(k log k).
+// Nodes themselves live in a pool of events_limit slots allocated up front.
+// Values decay as decay_policy says, linear_decay by default.
+//
+// Windows shorter than the period may be configured as well: every node then carries
+// a size and a frequency decayed over each of them, kept in a table parallel to the pool
+// (window_states, indexed by pool slot), and each window has its own pair of heaps.
+// One pass over the events and one set of keys serve all windows; get_top answers the
+// smallest configured window not shorter than the period asked for. Shorter windows decay
+// linearly whatever the decay policy of the period is.
+template<typename E, template<typename> class admission_policy = admit_all,
+         template<typename> class decay_policy = linear_decay>
+class top_lru
+{
+    typedef node_t<E> node_type;
+    typedef ::treap< node_type > treap_t;
+    typedef decay_policy<E> decay_type;
+
+    // values of a node decayed over one of the shorter windows
+    struct window_state_t
+    {
+        uint64_t size;
+        double freq;
+        size_t size_pos, freq_pos;
+    };
+
+    struct size_traits
+    {
+        static bool less(const node_type *lhs, const node_type *rhs) { return decay_type::size_key(lhs) < decay_type::size_key(rhs); }
+        static size_t &position(node_type *node) { return node->size_pos; }
+    };
+
+    struct freq_traits
+    {
+        static bool less(const node_type *lhs, const node_type *rhs) { return decay_type::freq_key(lhs) < decay_type::freq_key(rhs); }
+        static size_t &position(node_type *node) { return node->freq_pos; }
+    };
+
+    // heaps of the shorter windows order nodes by their state in the window
+    struct window_size_traits
+    {
+        top_lru *lru;
+        size_t w;
+        bool less(const node_type *lhs, const node_type *rhs) const { return lru->state(lhs, w).size < lru->state(rhs, w).size; }
+        size_t &position(node_type *node) const { return lru->state(node, w).size_pos; }
+    };
+
+    struct window_freq_traits
+    {
+        top_lru *lru;
+        size_t w;
+        bool less(const node_type *lhs, const node_type *rhs) const { return lru->state(lhs, w).freq < lru->state(rhs, w).freq; }
+        size_t &position(node_type *node) const { return lru->state(node, w).freq_pos; }
+    };
+
+    typedef indexed_heap< node_type, size_traits > size_heap_t;
+    typedef indexed_heap< node_type, freq_traits > freq_heap_t;
+    typedef indexed_heap< node_type, window_size_traits > window_size_heap_t;
+    typedef indexed_heap< node_type, window_freq_traits > window_freq_heap_t;
+
+    enum { PREFETCH_DISTANCE = 8 };
+
+public:
+    // windows_in_seconds: windows get_top answers besides the period; those not shorter
+    // than the period are the period itself
+    top_lru(size_t events_limit, size_t top_k, int period_in_seconds,
+            const std::vector<int> &windows_in_seconds = std::vector<int>())
     : num_events(0),
      max_events(events_limit),
-     period(period_in_seconds)
+     period(period_in_seconds),
+     windows(shorter_windows(windows_in_seconds, period_in_seconds)),
+     pool(events_limit),
+     treap(events_limit),
+     window_states(events_limit * windows.size()),
+     admission(events_limit),
+     decay(period_in_seconds)
+    {
+        size_heap.reserve( events_limit );
+        freq_heap.reserve( events_limit );
+        for(size_t w = 0; w < windows.size(); ++w)
+        {
+            window_size_heaps.push_back( window_size_heap_t( window_size_traits{ this, w } ) );
+            window_size_heaps.back().reserve( events_limit );
+            window_freq_heaps.push_back( window_freq_heap_t( window_freq_traits{ this, w } ) );
+            window_freq_heaps.back().reserve( events_limit );
+        }
+        top_nodes.reserve( top_k );
+    }
+
+    ~top_lru()
     {
+        treap.release();
     }
 
+    // top_freq is ordered by freq_double
+    enum { FREQ_BY_DOUBLE = 1 };
+
     void add_event(const E &event, time_t time)
     {
-        typename treap_t::p_node_type it = treap.find( reinterpret_cast<typename treap_t::key_type>( event.key.c_str() ) );
+        decay.advance( time, treap );
+        admission.record( event );
+        typename treap_t::p_node_type it = treap.find( event.key );
         if (it)
         {
-            it->update_size( time, period, event.size );
-            it->update_freq( time, period, 1. );
+            decay.add( it, time, event.size );
+            update_windows( it, time, event.size );
             it->update_time( time );
-            treap.decrease_key(it);
+            treap.update_priority(it);
+            size_heap.update(it);
+            freq_heap.update(it);
         }
         else
         {
             if (num_events < max_events)
             {
-                treap.insert( new node_t<E>(event) );
                 ++num_events;
             }
             else
             {
-                typename treap_t::p_node_type t = treap.top();
-                treap.erase(t);
-                delete t;
-                treap.insert( new node_t<E>(event) );
+                const node_type *victim = treap.top();
+                if (!victim->is_expired( time, period ) && !admission.admit( victim->get_item() ))
+                    return;
+                erase_node( treap.top() );
             }
+            node_type *n = pool.create(event);
+            decay.init( n );
+            treap.insert( n );
+            size_heap.push( n );
+            freq_heap.push( n );
+            push_windows( n );
+        }
+    }
+
+    // adds events with their own time, index slots and nodes of the following events
+    // are prefetched while the current one is processed
+    void add_events(const E *events, size_t count)
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            if (i + PREFETCH_DISTANCE < count)
+                treap.prefetch( events[i + PREFETCH_DISTANCE].key, 0 );
+            if (i + PREFETCH_DISTANCE / 2 < count)
+                treap.prefetch( events[i + PREFETCH_DISTANCE / 2].key, 1 );
+            add_event( events[i], events[i].time );
         }
     }
 
+    // erases nodes not updated for the period
+    void tick(time_t time)
+    {
+        expire( time, period );
+    }
+
+    // the period is rounded up to a configured window; nodes are only expired for the
+    // longest one, shorter windows skip them instead
     template< typename ResultContainer >
     void get_top(size_t k, int period_in_seconds, time_t time, ResultContainer &top_size, ResultContainer &top_freq)
     {
-        int period = min(this->period, period_in_seconds);
+        expire( time, period );
+
+        const size_t w = window_of( period_in_seconds );
+        if (w < windows.size())
+        {
+            window_top( window_size_heaps[w], w, k, time, top_size );
+            window_top( window_freq_heaps[w], w, k, time, top_freq );
+            return;
+        }
 
-        vector< typename treap_t::p_node_type > top_nodes;
-        treap_to_container( treap.top(), top_nodes );
+        top_nodes.clear();
+        size_heap.top_k( k, top_nodes );
+        for( auto n : top_nodes )
+        {
+            top_size.push_back( decay.item( n, time ) );
+        }
 
+        top_nodes.clear();
+        freq_heap.top_k( k, top_nodes );
         for( auto n : top_nodes )
         {
-            n->check_expiration( time, period );
-            if ( n->get_size() == 0 )
+            top_freq.push_back( decay.item( n, time ) );
+        }
+    }
+
+    treap_stats depth_stats() const
+    {
+        return treap.stats();
+    }
+
+    // state for snapshots: items of all tracked nodes as of their last update, no errors
+    template< typename ResultContainer >
+    void export_items(ResultContainer &items, ResultContainer &errors) const
+    {
+        treap.for_each( [&items]( const node_type *n ) { items.push_back( n->get_item() ); } );
+    }
+
+    template< typename F >
+    void for_each_item(F f) const
+    {
+        treap.for_each( [&f]( const node_type *n ) { f( n->get_item() ); } );
+    }
+
+    // restores nodes from exported items, existing keys are kept as they are;
+    // if there are more items than events_limit, the most recent ones are kept
+    void import_items(const E *items, const E *errors, size_t count)
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            const E &item = items[i];
+            if (treap.find( item.key ))
+                continue;
+            decay.advance( item.time, treap );
+
+            if (num_events < max_events)
+            {
+                ++num_events;
+            }
+            else if (treap.top()->eventtime() < static_cast<size_t>(item.time))
             {
-                treap.erase( n );
-                delete n;
-                --num_events;
+                erase_node( treap.top() );
             }
             else
             {
-                 top_size.push_back( n->get_item() );
-                 top_freq.push_back( n->get_item() );
+                continue;
             }
+
+            node_type *n = pool.create(item);
+            decay.init( n );
+            treap.insert( n );
+            size_heap.push( n );
+            freq_heap.push( n );
+            push_windows( n );
         }
+    }
 
-        k = min(top_size.size(), k);
-        std::function<decltype(E::size_compare)> comparator_size( &E::size_compare );
-        partial_sort(top_size.begin(), top_size.begin() + k, top_size.end(), std::not2(comparator_size) );
-        top_size.resize(k);
+private:
+    void expire( time_t time, int period )
+    {
+        // treap top is the least recently updated node, so expired nodes are popped from there
+        while( !treap.empty() && treap.top()->is_expired( time, period ) )
+        {
+            erase_node( treap.top() );
+            --num_events;
+        }
+    }
 
-        std::function<decltype(E::freq_double_compare)> comparator_freq( &E::freq_double_compare );
-        partial_sort(top_freq.begin(), top_freq.begin() + k, top_freq.end(), std::not2(comparator_freq) );
-        top_freq.resize(k);
+    void erase_node( node_type *n )
+    {
+        treap.erase( n );
+        size_heap.erase( n );
+        freq_heap.erase( n );
+        for(size_t w = 0; w < windows.size(); ++w)
+        {
+            window_size_heaps[w].erase( n );
+            window_freq_heaps[w].erase( n );
+        }
+        pool.destroy( n );
     }
 
-private:
-    template<typename Container>
-    void treap_to_container( const typename treap_t::p_node_type node, Container &container ) const
+    // sorted, without duplicates and without those not shorter than the period
+    static std::vector<int> shorter_windows(std::vector<int> windows, int period)
+    {
+        sort( windows.begin(), windows.end() );
+        windows.erase( unique( windows.begin(), windows.end() ), windows.end() );
+        windows.erase( remove_if( windows.begin(), windows.end(),
+                                  [period]( int w ) { return w <= 0 || w >= period; } ),
+                       windows.end() );
+        return windows;
+    }
+
+    // index of the smallest window not shorter than period, windows.size() for the period itself
+    size_t window_of( int period ) const
+    {
+        return lower_bound( windows.begin(), windows.end(), period ) - windows.begin();
+    }
+
+    window_state_t &state( const node_type *n, size_t w )
+    {
+        return window_states[pool.index( n ) * windows.size() + w];
+    }
+
+    // a new node starts every window with its item values
+    void push_windows( node_type *n )
     {
-        if ( node )
+        for(size_t w = 0; w < windows.size(); ++w)
         {
-            container.push_back( node );
-            treap_to_container( node->l, container );
-            treap_to_container( node->r, container ); 
+            window_state_t &s = state( n, w );
+            s.size = n->get_size();
+            s.freq = n->get_freq();
+            window_size_heaps[w].push( n );
+            window_freq_heaps[w].push( n );
+        }
+    }
+
+    // decays the window values since the node's last update, so it must be called before update_time
+    void update_windows( node_type *n, time_t time, size_t size )
+    {
+        for(size_t w = 0; w < windows.size(); ++w)
+        {
+            window_state_t &s = state( n, w );
+            const double delta = node_type::compute_delta( time, n->eventtime(), windows[w] );
+            s.size = delta * s.size + size;
+            s.freq = delta * s.freq + 1.;
+            window_size_heaps[w].update( n );
+            window_freq_heaps[w].update( n );
+        }
+    }
+
+    // Top of a shorter window. A node not updated within the window still has its last
+    // values in the window heaps, while decay has taken them to zero by now, so such nodes
+    // coming up are zeroed and the top is taken again; each node is zeroed once after its
+    // last update. They are left out of the result.
+    template< typename Heap, typename ResultContainer >
+    void window_top( Heap &heap, size_t w, size_t k, time_t time, ResultContainer &top )
+    {
+        bool zeroed = true;
+        while( zeroed )
+        {
+            zeroed = false;
+            top_nodes.clear();
+            heap.top_k( k, top_nodes );
+            for( auto n : top_nodes )
+            {
+                window_state_t &s = state( n, w );
+                if (n->is_expired( time, windows[w] ) && (s.size || s.freq))
+                {
+                    s.size = 0;
+                    s.freq = 0.;
+                    window_size_heaps[w].update( n );
+                    window_freq_heaps[w].update( n );
+                    zeroed = true;
+                }
+            }
+        }
+
+        for( auto n : top_nodes )
+        {
+            if (n->is_expired( time, windows[w] ))
+                continue;
+            E item( n->get_item() );
+            item.size = state( n, w ).size;
+            item.freq_double = state( n, w ).freq;
+            top.push_back( item );
         }
     }
 
@@ -460,8 +989,566 @@ private:
     size_t num_events;
     size_t max_events;
     int period;
+    std::vector<int> windows; // shorter than period, ascending
+    object_pool< node_type > pool;
     treap_t treap;
+    size_heap_t size_heap;
+    freq_heap_t freq_heap;
+    std::vector< window_state_t > window_states;
+    std::vector< window_size_heap_t > window_size_heaps;
+    std::vector< window_freq_heap_t > window_freq_heaps;
+    vector< node_type * > top_nodes;
+    admission_policy<E> admission;
+    decay_type decay;
 };
-#endif // TOP_LRU
+
+// Space-Saving (Metwally, Agrawal, El Abbadi) over a Stream-Summary.
+// A fixed set of events_limit counters is kept in buckets of equal frequency,
+// buckets are linked in increasing frequency order, so add_event is O(1) and
+// the minimal counter is always at the head bucket.
+// When a new key arrives and all counters are in use, the counter of minimal
+// freq is taken over: its freq and size are inherited and recorded as the error
+// of the new key, so every reported value overestimates the real one by at most
+// freq_error (size_error). freq_error never exceeds the minimal freq; size_error
+// has no such bound, the counter taken over is the least frequent, not the lightest.
+// Counters not touched for a period are expired by tick or lazily in get_top.
+// Counters in use are also linked in the order they were last touched, so tick
+// expires them from the old end as the treap of top_lru does, without a scan.
+template<typename E>
+class top_space_saving
+{
+    struct bucket_t;
+
+    struct counter_t
+    {
+        E item;
+        uint64_t freq_error;
+        uint64_t size_error;
+        bucket_t *bucket;
+        counter_t *prev, *next;
+        counter_t *older, *newer; // by the time last touched
+    };
+
+    struct bucket_t
+    {
+        uint64_t freq;
+        counter_t *counters;
+        bucket_t *prev, *next;
+    };
+
+    typedef std::unordered_map< decltype(E::key), counter_t * > IndexT;
+
+public:
+    // Counts cover the whole period, a counter is only restarted after a period without its
+    // key, so windows shorter than the period are refused with std::invalid_argument.
+    // get_top given a shorter period still skips counters of keys not seen within it,
+    // but the counts of the others are of the whole period.
+    top_space_saving(size_t events_limit, size_t top_k, int period_in_seconds,
+                     const std::vector<int> &windows_in_seconds = std::vector<int>())
+    : num_events(0),
+     max_events(events_limit),
+     period(period_in_seconds),
+     counters( new counter_t[events_limit] ),
+     buckets( new bucket_t[events_limit] ),
+     free_counters(nullptr), free_buckets(nullptr),
+     bucket_head(nullptr), bucket_tail(nullptr),
+     oldest(nullptr), newest(nullptr)
+    {
+        for(size_t i = 0; i < events_limit; ++i)
+        {
+            counters[i].next = free_counters;
+            free_counters = &counters[i];
+            buckets[i].next = free_buckets;
+            free_buckets = &buckets[i];
+        }
+        index.reserve( events_limit );
+
+        for( int w : windows_in_seconds )
+        {
+            if (w < period)
+                throw std::invalid_argument( "space-saving counts over the whole period, it has no shorter windows" );
+        }
+    }
+
+    // top_freq is ordered by freq
+    enum { FREQ_BY_DOUBLE = 0 };
+
+    void add_event(const E &event, time_t time)
+    {
+        auto it = index.find( event.key );
+        if (it != index.end())
+        {
+            counter_t *c = it->second;
+            if (time - c->item.time > period)
+            {
+                // window has passed since the last hit, start counting again
+                restart(c, event);
+            }
+            else
+            {
+                c->item.set_size( c->item.get_size() + event.get_size() );
+                increment(c);
+            }
+            c->item.time = time;
+            unlink_recent(c);
+            link_newest(c);
+        }
+        else
+        {
+            counter_t *c;
+            if (num_events < max_events)
+            {
+                c = free_counters;
+                free_counters = c->next;
+                ++num_events;
+                c->item = event;
+                c->freq_error = 0;
+                c->size_error = 0;
+                attach(c, head_bucket(1));
+                link_newest(c);
+            }
+            else
+            {
+                c = bucket_head->counters;
+                index.erase( c->item.key );
+                const uint64_t freq = bucket_head->freq;
+                const uint64_t size = c->item.get_size();
+                c->item = event;
+                c->item.set_size( size + event.get_size() );
+                c->freq_error = freq;
+                c->size_error = size;
+                increment(c);
+                unlink_recent(c);
+                link_newest(c);
+            }
+            c->item.time = time;
+            index.emplace( c->item.key, c );
+        }
+    }
+
+    // adds events with their own time
+    void add_events(const E *events, size_t count)
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            add_event( events[i], events[i].time );
+        }
+    }
+
+    // releases counters not touched for the period, from the least recently touched one
+    // on; a quiet second costs a look at the oldest counter
+    void tick(time_t time)
+    {
+        while( oldest && time - oldest->item.time > period )
+        {
+            release(oldest);
+        }
+    }
+
+    template< typename ResultContainer >
+    void get_top(size_t k, int period_in_seconds, time_t time, ResultContainer &top_size, ResultContainer &top_freq)
+    {
+        int period = min(this->period, period_in_seconds);
+
+        vector< counter_t * > top_counters;
+        top_counters.reserve( num_events );
+
+        bucket_t *b = bucket_head;
+        while( b )
+        {
+            bucket_t *next_bucket = b->next;
+            counter_t *c = b->counters;
+            while( c )
+            {
+                counter_t *next = c->next;
+                if (time - c->item.time > this->period)
+                    release(c);
+                else if (time - c->item.time <= period)
+                    top_counters.push_back(c);
+                c = next;
+            }
+            b = next_bucket;
+        }
+
+        // buckets are sorted by frequency, so top by frequency is just a walk from the tail
+        for( b = bucket_tail; b && top_freq.size() < k; b = b->prev )
+        {
+            for( counter_t *c = b->counters; c && top_freq.size() < k; c = c->next )
+            {
+                if (time - c->item.time <= period)
+                    top_freq.push_back( c->item );
+            }
+        }
+
+        k = min(top_counters.size(), k);
+        partial_sort(top_counters.begin(), top_counters.begin() + k, top_counters.end(),
+                     [](const counter_t *lhs, const counter_t *rhs) { return lhs->item.get_size() > rhs->item.get_size(); });
+        for(size_t i = 0; i < k; ++i)
+        {
+            top_size.push_back( top_counters[i]->item );
+        }
+    }
+
+    // state for snapshots: a counter is an item, its freq_error and size_error are the freq
+    // and size of its error; least recently touched first
+    template< typename ResultContainer >
+    void export_items(ResultContainer &items, ResultContainer &errors) const
+    {
+        for( const counter_t *c = oldest; c; c = c->newer )
+        {
+            items.push_back( c->item );
+            E error( c->item );
+            error.size = c->size_error;
+            error.freq = c->freq_error;
+            error.freq_double = 0.;
+            errors.push_back( error );
+        }
+    }
+
+    template< typename F >
+    void for_each_item(F f) const
+    {
+        for( const counter_t *c = oldest; c; c = c->newer )
+            f( c->item );
+    }
+
+    // restores counters from exported items, errors may be null for items counted exactly;
+    // existing keys are kept as they are. If there are more items than events_limit,
+    // an item takes over the minimal counter if its freq is higher, the other one is lost
+    // along with what it counted.
+    void import_items(const E *items, const E *errors, size_t count)
+    {
+        std::vector<size_t> order( count );
+        for(size_t i = 0; i < count; ++i)
+        {
+            order[i] = i;
+        }
+        stable_sort( order.begin(), order.end(),
+                     [items]( size_t lhs, size_t rhs ) { return items[lhs].time < items[rhs].time; } );
+
+        for( size_t i : order )
+        {
+            const E &item = items[i];
+            if (index.count( item.key ))
+                continue;
+
+            const uint64_t freq = max<uint64_t>( item.get_freq(), 1 );
+            counter_t *c;
+            if (num_events < max_events)
+            {
+                c = free_counters;
+                free_counters = c->next;
+                ++num_events;
+            }
+            else if (bucket_head->freq < freq)
+            {
+                c = bucket_head->counters;
+                index.erase( c->item.key );
+                detach(c);
+                unlink_recent(c);
+            }
+            else
+            {
+                continue;
+            }
+
+            c->item = item;
+            c->freq_error = errors ? errors[i].get_freq() : 0;
+            c->size_error = errors ? errors[i].get_size() : 0;
+            attach(c, bucket_of(freq));
+            link_by_time(c);
+            index.emplace( c->item.key, c );
+        }
+    }
+
+private:
+    bucket_t *alloc_bucket(uint64_t freq)
+    {
+        bucket_t *b = free_buckets;
+        free_buckets = b->next;
+        b->freq = freq;
+        b->counters = nullptr;
+        b->prev = b->next = nullptr;
+        return b;
+    }
+
+    // link bucket b right after pos, or as the new head if pos is null
+    void link_bucket(bucket_t *pos, bucket_t *b)
+    {
+        b->prev = pos;
+        b->next = pos ? pos->next : bucket_head;
+        if (b->next)
+            b->next->prev = b;
+        else
+            bucket_tail = b;
+        if (pos)
+            pos->next = b;
+        else
+            bucket_head = b;
+    }
+
+    void unlink_bucket(bucket_t *b)
+    {
+        if (b->prev)
+            b->prev->next = b->next;
+        else
+            bucket_head = b->next;
+        if (b->next)
+            b->next->prev = b->prev;
+        else
+            bucket_tail = b->prev;
+        b->next = free_buckets;
+        free_buckets = b;
+    }
+
+    // bucket of freq, linked in place if there is none yet
+    bucket_t *bucket_of(uint64_t freq)
+    {
+        bucket_t *b = bucket_tail;
+        while( b && b->freq > freq )
+        {
+            b = b->prev;
+        }
+        if (b && b->freq == freq)
+            return b;
+        bucket_t *nb = alloc_bucket(freq);
+        link_bucket(b, nb);
+        return nb;
+    }
+
+    bucket_t *head_bucket(uint64_t freq)
+    {
+        if (bucket_head && bucket_head->freq == freq)
+            return bucket_head;
+        bucket_t *b = alloc_bucket(freq);
+        link_bucket(nullptr, b);
+        return b;
+    }
+
+    void attach(counter_t *c, bucket_t *b)
+    {
+        c->bucket = b;
+        c->prev = nullptr;
+        c->next = b->counters;
+        if (c->next)
+            c->next->prev = c;
+        b->counters = c;
+        c->item.set_freq( b->freq );
+    }
+
+    void detach(counter_t *c)
+    {
+        bucket_t *b = c->bucket;
+        if (c->prev)
+            c->prev->next = c->next;
+        else
+            b->counters = c->next;
+        if (c->next)
+            c->next->prev = c->prev;
+        if (!b->counters)
+            unlink_bucket(b);
+    }
+
+    void increment(counter_t *c)
+    {
+        bucket_t *b = c->bucket;
+        const uint64_t freq = b->freq + 1;
+        if (!c->prev && !c->next && (!b->next || b->next->freq != freq))
+        {
+            // the only counter in its bucket, bump the bucket in place
+            b->freq = freq;
+            c->item.set_freq( freq );
+            return;
+        }
+
+        bucket_t *next = b->next;
+        if (!next || next->freq != freq)
+        {
+            next = alloc_bucket(freq);
+            link_bucket(b, next);
+        }
+        detach(c);
+        attach(c, next);
+    }
+
+    void restart(counter_t *c, const E &event)
+    {
+        detach(c);
+        c->item.set_size( event.get_size() );
+        c->freq_error = 0;
+        c->size_error = 0;
+        attach(c, head_bucket(1));
+    }
+
+    void link_newest(counter_t *c)
+    {
+        c->older = newest;
+        c->newer = nullptr;
+        if (newest)
+            newest->newer = c;
+        else
+            oldest = c;
+        newest = c;
+    }
+
+    // links a counter touched at its item's time, which may be older than the newest
+    void link_by_time(counter_t *c)
+    {
+        counter_t *pos = newest;
+        while( pos && pos->item.time > c->item.time )
+        {
+            pos = pos->older;
+        }
+        c->older = pos;
+        c->newer = pos ? pos->newer : oldest;
+        if (c->newer)
+            c->newer->older = c;
+        else
+            newest = c;
+        if (pos)
+            pos->newer = c;
+        else
+            oldest = c;
+    }
+
+    void unlink_recent(counter_t *c)
+    {
+        if (c->older)
+            c->older->newer = c->newer;
+        else
+            oldest = c->newer;
+        if (c->newer)
+            c->newer->older = c->older;
+        else
+            newest = c->older;
+    }
+
+    void release(counter_t *c)
+    {
+        detach(c);
+        unlink_recent(c);
+        index.erase( c->item.key );
+        c->next = free_counters;
+        free_counters = c;
+        --num_events;
+    }
+
+private:
+    size_t num_events;
+    size_t max_events;
+    int period;
+    std::unique_ptr<counter_t[]> counters;
+    std::unique_ptr<bucket_t[]> buckets;
+    counter_t *free_counters;
+    bucket_t *free_buckets;
+    bucket_t *bucket_head, *bucket_tail;
+    counter_t *oldest, *newest;
+    IndexT index;
+};
+
+// Common interface of the strategies, one of them is picked at runtime with create
+template<typename E>
+class event_stats
+{
+public:
+    typedef std::vector<E> container_type;
+    typedef bool (*compare_type)(const E &, const E &);
+
+    virtual ~event_stats() {}
+
+    virtual void add_event(const E &event, time_t time) = 0;
+
+    // adds events with their own time
+    virtual void add_events(const E *events, size_t count) = 0;
+
+    // periodic maintenance as of time (building slices, expiring keys), driven by a clock
+    // every second; get_top does what is left of it itself, so ticks are optional
+    virtual void tick(time_t time) = 0;
+
+    virtual void get_top(size_t k, int period_in_seconds, time_t time, container_type &top_size, container_type &top_freq) = 0;
+
+    // State for snapshots, std::logic_error if the strategy has none. Strategies whose
+    // values overestimate the exact ones export the error of every item too, in the same
+    // order (size and freq of an item's error); the others leave errors empty.
+    // import_items takes errors as exported, or null.
+    virtual void export_items(container_type &items, container_type &errors) const = 0;
+    virtual void import_items(const E *items, const E *errors, size_t count) = 0;
+
+    // calls f for every item held, so that the strings they refer to can be kept
+    virtual void for_each_item(const std::function<void(const E &)> &f) const = 0;
+
+    // order of top_freq results
+    virtual compare_type freq_compare() const = 0;
+
+    // strategy is one of strategy_names(), std::invalid_argument otherwise.
+    // get_top answers periods up to period_in_seconds; windows_in_seconds are periods
+    // to be answered besides it, which top_lru has to track separately
+    static std::unique_ptr<event_stats> create(const std::string &strategy, size_t events_limit, size_t top_k, int period_in_seconds,
+                                               const std::vector<int> &windows_in_seconds = std::vector<int>());
+
+    static const char *strategy_names() { return "simple, slices, lru, lru-tinylfu, lru-decay, space-saving"; }
+};
+
+template<typename E, typename strategy>
+class event_stats_adapter : public event_stats<E>
+{
+    typedef event_stats<E> base;
+
+public:
+    event_stats_adapter(size_t events_limit, size_t top_k, int period_in_seconds, const std::vector<int> &windows_in_seconds)
+    : impl(events_limit, top_k, period_in_seconds, windows_in_seconds)
+    {}
+
+    virtual void add_event(const E &event, time_t time) { impl.add_event( event, time ); }
+
+    virtual void add_events(const E *events, size_t count) { impl.add_events( events, count ); }
+
+    virtual void tick(time_t time) { impl.tick( time ); }
+
+    virtual void get_top(size_t k, int period_in_seconds, time_t time,
+                         typename base::container_type &top_size, typename base::container_type &top_freq)
+    {
+        impl.get_top( k, period_in_seconds, time, top_size, top_freq );
+    }
+
+    virtual void export_items(typename base::container_type &items, typename base::container_type &errors) const
+    {
+        impl.export_items( items, errors );
+    }
+
+    virtual void import_items(const E *items, const E *errors, size_t count) { impl.import_items( items, errors, count ); }
+
+    virtual void for_each_item(const std::function<void(const E &)> &f) const { impl.for_each_item( f ); }
+
+    virtual typename base::compare_type freq_compare() const
+    {
+        return strategy::FREQ_BY_DOUBLE ? &E::freq_double_compare : &E::freq_compare;
+    }
+
+private:
+    strategy impl;
+};
+
+template<typename E>
+std::unique_ptr< event_stats<E> > event_stats<E>::create(const std::string &strategy, size_t events_limit, size_t top_k, int period_in_seconds,
+                                                         const std::vector<int> &windows_in_seconds)
+{
+    event_stats<E> *stats = nullptr;
+    if (strategy == "simple")
+        stats = new event_stats_adapter< E, top_simple<E> >( events_limit, top_k, period_in_seconds, windows_in_seconds );
+    else if (strategy == "slices")
+        stats = new event_stats_adapter< E, top_slices<E> >( events_limit, top_k, period_in_seconds, windows_in_seconds );
+    else if (strategy == "lru")
+        stats = new event_stats_adapter< E, top_lru<E> >( events_limit, top_k, period_in_seconds, windows_in_seconds );
+    else if (strategy == "lru-tinylfu")
+        stats = new event_stats_adapter< E, top_lru<E, sketch_admission> >( events_limit, top_k, period_in_seconds, windows_in_seconds );
+    else if (strategy == "lru-decay")
+        stats = new event_stats_adapter< E, top_lru<E, admit_all, exponential_decay> >( events_limit, top_k, period_in_seconds, windows_in_seconds );
+    else if (strategy == "space-saving")
+        stats = new event_stats_adapter< E, top_space_saving<E> >( events_limit, top_k, period_in_seconds, windows_in_seconds );
+    else
+        throw std::invalid_argument( "unknown event_stats strategy: " + strategy );
+    return std::unique_ptr< event_stats<E> >( stats );
+}
 
 #endif // EVENT_STATS_HPP
@@ -0,0 +1,215 @@
+#ifndef EVENT_SUMMARY_HPP
+#define EVENT_SUMMARY_HPP
+
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+
+// Mergeable summary of an event_stats instance: the top `capacity` keys by size and by
+// frequency, as reported by get_top of any TOP_* implementation, with error bounds.
+//
+// Every entry holds a value and an error, both are events whose size, freq and freq_double
+// are summed on merge. For an entry of a summary made of several nodes, the true total of
+// the key over those nodes (as their event_stats would report it) lies in
+// [value, value + error]. The bound of a list is an upper bound of the total of any key
+// not in the list. A node's own summary has zero errors, its bound is the smallest
+// reported value if the list was cut at capacity, and zero otherwise.
+//
+// Merging A and B: a key in both sums values and errors; a key only in A gets B's bound
+// added to its error (it may have been cut from B), and vice versa; the bound is the sum
+// of both bounds. If the merged list is cut at capacity, the bound is raised to the
+// largest value + error dropped. Only the metric a list is ordered by is bounded, the
+// other fields of its entries are sums over the nodes that reported the key.
+// The frequency list is ordered as top_freq of the strategy the summary was made from,
+// summaries of strategies ordering it by different fields can't be merged.
+//
+// The bounds only account for merging: the values of a node are taken as its strategy
+// reports them, with zero error. That is the true count of the node for top_simple only;
+// slices and lru undercount keys they dropped or expired early, and space-saving
+// overcounts by the error of its counters, which isn't carried into the summary. The zero
+// bound of a list shorter than capacity likewise holds for top_simple only, the other
+// strategies may have forgotten keys.
+//
+// Bounds grow with the number of merges that cut keys, so merge_tree merges pairs level
+// by level, which keeps the depth at log2 of the number of summaries.
+template<typename E>
+class event_summary
+{
+public:
+    struct entry
+    {
+        E value;
+        E error;
+    };
+
+    typedef std::vector<entry> list_type;
+    typedef bool (*compare_type)(const E &, const E &);
+
+    explicit event_summary(size_t capacity = 0, compare_type freq_compare = &E::freq_compare)
+    : capacity(capacity),
+     freq_less(freq_compare)
+    {
+        clear_event( size_bound );
+        clear_event( freq_bound );
+    }
+
+    // summary of the top `capacity` keys of stats, as of time
+    template<typename Stats>
+    static event_summary from_stats(Stats &stats, size_t capacity, int period_in_seconds, time_t time)
+    {
+        std::vector<E> top_size, top_freq;
+        stats.get_top( capacity, period_in_seconds, time, top_size, top_freq );
+
+        event_summary summary( capacity, stats.freq_compare() );
+        summary.assign( summary.by_size, summary.size_bound, top_size );
+        summary.assign( summary.by_freq, summary.freq_bound, top_freq );
+        return summary;
+    }
+
+    void merge(const event_summary &other)
+    {
+        if (freq_less != other.freq_less)
+            throw std::invalid_argument("event_summary: frequency lists are ordered differently");
+
+        capacity = std::max( capacity, other.capacity );
+        merge_list( by_size, size_bound, other.by_size, other.size_bound, &E::size_compare );
+        merge_list( by_freq, freq_bound, other.by_freq, other.freq_bound, freq_less );
+    }
+
+    // merges summaries pairwise, level by level, the result is left in summaries[0]
+    static void merge_tree(std::vector<event_summary> &summaries)
+    {
+        for(size_t step = 1; step < summaries.size(); step *= 2)
+        {
+            for(size_t i = 0; i + step < summaries.size(); i += 2 * step)
+            {
+                summaries[i].merge( summaries[i + step] );
+                summaries[i + step] = event_summary();
+            }
+        }
+    }
+
+    // top k of both lists in the order of event_stats::get_top
+    template< typename ResultContainer >
+    void get_top(size_t k, ResultContainer &top_size, ResultContainer &top_freq) const
+    {
+        for(size_t i = 0; i < by_size.size() && i < k; ++i)
+        {
+            top_size.push_back( by_size[i] );
+        }
+        for(size_t i = 0; i < by_freq.size() && i < k; ++i)
+        {
+            top_freq.push_back( by_freq[i] );
+        }
+    }
+
+    size_t get_capacity() const { return capacity; }
+
+    compare_type freq_compare() const { return freq_less; }
+
+    const list_type &size_list() const { return by_size; }
+    const list_type &freq_list() const { return by_freq; }
+    list_type &size_list() { return by_size; }
+    list_type &freq_list() { return by_freq; }
+
+    const E &get_size_bound() const { return size_bound; }
+    const E &get_freq_bound() const { return freq_bound; }
+    E &get_size_bound() { return size_bound; }
+    E &get_freq_bound() { return freq_bound; }
+
+private:
+    static void clear_event(E &e)
+    {
+        e = E();
+    }
+
+    static void add(E &to, const E &e)
+    {
+        to.size += e.size;
+        to.freq += e.freq;
+        to.freq_double += e.freq_double;
+    }
+
+    static E upper(const entry &e)
+    {
+        E u( e.value );
+        add( u, e.error );
+        return u;
+    }
+
+    void assign(list_type &list, E &bound, const std::vector<E> &top)
+    {
+        list.clear();
+        for( const auto &e : top )
+        {
+            entry en;
+            en.value = e;
+            clear_event( en.error );
+            list.push_back( en );
+        }
+
+        clear_event( bound );
+        if (!top.empty() && top.size() >= capacity)
+        {
+            bound = top.back();
+        }
+    }
+
+    void merge_list(list_type &list, E &bound, const list_type &other, const E &other_bound, compare_type less)
+    {
+        std::unordered_map< decltype(E::key), size_t > index;
+        index.reserve( list.size() + other.size() );
+        for(size_t i = 0; i < list.size(); ++i)
+        {
+            index[ list[i].value.key ] = i;
+        }
+
+        std::vector<bool> seen( list.size(), false );
+        for( const auto &o : other )
+        {
+            auto it = index.find( o.value.key );
+            if (it != index.end())
+            {
+                entry &en = list[it->second];
+                add( en.value, o.value );
+                add( en.error, o.error );
+                en.value.time = std::max( en.value.time, o.value.time );
+                seen[it->second] = true;
+            }
+            else
+            {
+                entry en( o );
+                add( en.error, bound );
+                list.push_back( en );
+            }
+        }
+        for(size_t i = 0; i < seen.size(); ++i)
+        {
+            if (!seen[i])
+                add( list[i].error, other_bound );
+        }
+        add( bound, other_bound );
+
+        std::stable_sort( list.begin(), list.end(),
+                          [less]( const entry &lhs, const entry &rhs ) { return less( rhs.value, lhs.value ); } );
+        if (list.size() > capacity)
+        {
+            for(size_t i = capacity; i < list.size(); ++i)
+            {
+                const E u = upper( list[i] );
+                if (less( bound, u ))
+                    bound = u;
+            }
+            list.resize( capacity );
+        }
+    }
+
+private:
+    size_t capacity;
+    compare_type freq_less;
+    list_type by_size, by_freq;
+    E size_bound, freq_bound;
+};
+
+#endif // EVENT_SUMMARY_HPP
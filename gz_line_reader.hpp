@@ -0,0 +1,98 @@
+#ifndef GZ_LINE_READER_HPP
+#define GZ_LINE_READER_HPP
+
+#include <stdexcept>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <zlib.h>
+
+// Streaming line reader over a gzip compressed file. zlib passes through files that
+// are not compressed, so plain text is read as well. Memory use is bounded by the
+// buffer size (it only grows for a line longer than the whole buffer).
+class gz_line_reader {
+
+public:
+	explicit gz_line_reader(const char *file_name, size_t buffer_size = 1 << 20)
+	: name(file_name), buf(new char[buffer_size]), capacity(buffer_size), size(0), pos(0), eof(false) {
+		file = gzopen(file_name, "rb");
+		if (!file) {
+			throw std::runtime_error(std::string("can't open ") + file_name + ": " + strerror(errno));
+		}
+		gzbuffer(file, 256 * 1024);
+	}
+
+	~gz_line_reader() {
+		gzclose(file);
+	}
+
+	// Returns the next line without '\n', valid until the next call, or false at the end of input
+	bool next(const char *&line, size_t &len) {
+		while (true) {
+			const char *start = buf.get() + pos;
+			const char *eol = static_cast<const char *>(memchr(start, '\n', size - pos));
+			if (eol) {
+				line = start;
+				len = eol - start;
+				pos += len + 1;
+				return true;
+			}
+
+			if (eof) {
+				if (pos == size) {
+					return false;
+				}
+				// last line without '\n'
+				line = start;
+				len = size - pos;
+				pos = size;
+				return true;
+			}
+
+			fill();
+		}
+	}
+
+	const std::string &file_name() const {
+		return name;
+	}
+
+private:
+	gz_line_reader(const gz_line_reader &);
+	gz_line_reader &operator =(const gz_line_reader &);
+
+	void fill() {
+		// keep the unfinished line at the front of the buffer
+		size -= pos;
+		memmove(buf.get(), buf.get() + pos, size);
+		pos = 0;
+
+		if (size == capacity) {
+			std::unique_ptr<char[]> bigger(new char[2 * capacity]);
+			memcpy(bigger.get(), buf.get(), size);
+			buf.swap(bigger);
+			capacity *= 2;
+		}
+
+		int n = gzread(file, buf.get() + size, capacity - size);
+		if (n < 0) {
+			int err;
+			throw std::runtime_error("can't read " + name + ": " + gzerror(file, &err));
+		}
+		if (n == 0) {
+			eof = true;
+		}
+		size += n;
+	}
+
+	std::string name;
+	gzFile file;
+	std::unique_ptr<char[]> buf;
+	size_t capacity;
+	size_t size;
+	size_t pos;
+	bool eof;
+};
+
+#endif // GZ_LINE_READER_HPP
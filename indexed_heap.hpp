@@ -0,0 +1,149 @@
+#ifndef INDEXED_HEAP_HPP
+#define INDEXED_HEAP_HPP
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+// Binary max-heap of node pointers. Every node keeps its own position in the heap
+// (traits::position), so a node may be updated or erased in O(log n) without a search.
+// traits::less(a, b) defines the order, traits::position(node) returns a reference
+// to the node's slot index. Both may be static or members of a traits object given to
+// the constructor, so several heaps over the same nodes can keep different keys.
+template<typename node_type, typename traits>
+class indexed_heap {
+
+public:
+	typedef node_type* p_node_type;
+
+	explicit indexed_heap(const traits &t = traits()): tr(t) {
+	}
+
+	void reserve(size_t n) {
+		heap.reserve(n);
+	}
+
+	void push(p_node_type node) {
+		if (!node) {
+			throw std::logic_error("push: can't push NULL");
+		}
+		tr.position(node) = heap.size();
+		heap.push_back(node);
+		sift_up(heap.size() - 1);
+	}
+
+	void erase(p_node_type node) {
+		size_t pos = tr.position(node);
+		if (pos >= heap.size() || heap[pos] != node) {
+			throw std::logic_error("erase: element does not exist");
+		}
+
+		p_node_type last = heap.back();
+		heap.pop_back();
+		if (last != node) {
+			place(pos, last);
+			update(last);
+		}
+	}
+
+	// restore the heap order after the node's key has changed in either direction
+	void update(p_node_type node) {
+		size_t pos = tr.position(node);
+		if (pos > 0 && tr.less(heap[(pos - 1) / 2], node)) {
+			sift_up(pos);
+		}
+		else {
+			sift_down(pos);
+		}
+	}
+
+	p_node_type top() const {
+		return heap.empty() ? NULL : heap.front();
+	}
+
+	size_t size() const {
+		return heap.size();
+	}
+
+	bool empty() const {
+		return heap.empty();
+	}
+
+	// append up to k largest nodes to container in decreasing order, O(k log k)
+	template<typename Container>
+	void top_k(size_t k, Container &container) const {
+		if (heap.empty() || !k) {
+			return;
+		}
+
+		candidates.clear();
+		candidates.push_back(0);
+		while (!candidates.empty() && k--) {
+			std::pop_heap(candidates.begin(), candidates.end(), candidate_less(heap, tr));
+			size_t pos = candidates.back();
+			candidates.pop_back();
+
+			container.push_back(heap[pos]);
+
+			for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < heap.size(); ++child) {
+				candidates.push_back(child);
+				std::push_heap(candidates.begin(), candidates.end(), candidate_less(heap, tr));
+			}
+		}
+	}
+
+private:
+	struct candidate_less {
+		candidate_less(const std::vector<p_node_type> &h, const traits &t): heap(h), tr(t) {}
+		bool operator()(size_t lhs, size_t rhs) const {
+			return tr.less(heap[lhs], heap[rhs]);
+		}
+		const std::vector<p_node_type> &heap;
+		const traits &tr;
+	};
+
+	void place(size_t pos, p_node_type node) {
+		heap[pos] = node;
+		tr.position(node) = pos;
+	}
+
+	void sift_up(size_t pos) {
+		p_node_type node = heap[pos];
+		while (pos > 0) {
+			size_t parent = (pos - 1) / 2;
+			if (!tr.less(heap[parent], node)) {
+				break;
+			}
+			place(pos, heap[parent]);
+			pos = parent;
+		}
+		place(pos, node);
+	}
+
+	void sift_down(size_t pos) {
+		p_node_type node = heap[pos];
+		const size_t n = heap.size();
+		while (true) {
+			size_t child = 2 * pos + 1;
+			if (child >= n) {
+				break;
+			}
+			if (child + 1 < n && tr.less(heap[child], heap[child + 1])) {
+				++child;
+			}
+			if (!tr.less(node, heap[child])) {
+				break;
+			}
+			place(pos, heap[child]);
+			pos = child;
+		}
+		place(pos, node);
+	}
+
+	traits tr;
+	std::vector<p_node_type> heap;
+	mutable std::vector<size_t> candidates;
+};
+
+#endif // INDEXED_HEAP_HPP
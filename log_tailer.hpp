@@ -0,0 +1,235 @@
+#ifndef LOG_TAILER_HPP
+#define LOG_TAILER_HPP
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+
+// Follows growing log files as `tail -F` does and passes their complete lines on.
+// The directories of the files are watched with inotify, so a write, a creation or a
+// rename in them wakes the tailer; without events the files are polled every POLL_MS
+// anyway (inotify misses writes on network file systems).
+// Rotation is detected by the inode behind the name: when it changes, the rest of the
+// old file is read and the new one is followed from its start. A file truncated in place
+// (copytruncate) is followed from its start as well. A file that doesn't exist yet is
+// picked up as soon as it appears.
+// Lines go out file by file in the order they are read; several files are not merged by
+// their timestamps, which the tailer knows nothing of.
+// The loop is also the clock of the reader: a timerfd at every whole second of wall clock
+// time wakes it to call the tick handler, so ticks and lines come from the same thread.
+class log_tailer {
+
+public:
+	// handler gets complete lines, each one ending with '\n'
+	typedef std::function<void (const char *data, size_t size)> handler_type;
+	// gets every second of wall clock time since the previous call, in order
+	typedef std::function<void (time_t time)> tick_handler_type;
+
+	// from_start: read what the files already hold, otherwise only what is appended later
+	log_tailer(const std::vector<const char *> &file_names, bool from_start) {
+		notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (notify_fd < 0) {
+			throw std::runtime_error(std::string("inotify_init1: ") + strerror(errno));
+		}
+		timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer_fd < 0) {
+			const std::string error = strerror(errno);
+			close(notify_fd);
+			throw std::runtime_error("timerfd_create: " + error);
+		}
+
+		for (auto name : file_names) {
+			file_t f;
+			f.name = name;
+			f.fd = -1;
+			f.inode = 0;
+			f.offset = 0;
+			files.push_back(f);
+
+			const std::string dir = dir_name(f.name);
+			if (inotify_add_watch(notify_fd, dir.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+				const std::string error = strerror(errno);
+				close_all();
+				throw std::runtime_error("can't watch " + dir + ": " + error);
+			}
+		}
+
+		for (auto &f : files) {
+			if (reopen(f) && !from_start) {
+				f.offset = lseek(f.fd, 0, SEEK_END);
+			}
+		}
+	}
+
+	~log_tailer() {
+		close_all();
+	}
+
+	// Reads the files as they grow and ticks every second until stop is set, which is checked
+	// at least every POLL_MS. A signal interrupting the wait is a reason to check stop too.
+	void run(const std::atomic<bool> &stop, const handler_type &handler, const tick_handler_type &on_tick) {
+		// first expiration at the next whole second, then every second
+		itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		spec.it_value.tv_sec = time(nullptr) + 1;
+		spec.it_interval.tv_sec = 1;
+		timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+		time_t last_tick = time(nullptr);
+
+		while (!stop.load()) {
+			for (auto &f : files) {
+				follow(f, handler);
+			}
+
+			pollfd p[2] = { { notify_fd, POLLIN, 0 }, { timer_fd, POLLIN, 0 } };
+			const int ready = poll(p, 2, POLL_MS);
+			if (ready < 0 && errno != EINTR) {
+				throw std::runtime_error(std::string("poll: ") + strerror(errno));
+			}
+			if (ready > 0 && p[0].revents) {
+				drain_events();
+			}
+			if (ready > 0 && p[1].revents) {
+				uint64_t expirations;
+				if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+					continue;
+				}
+				// lines written up to the tick are in before it
+				for (auto &f : files) {
+					follow(f, handler);
+				}
+				// a clock step back repeats nothing, a step forward ticks the seconds skipped
+				const time_t now = time(nullptr);
+				while (last_tick < now) {
+					on_tick(++last_tick);
+				}
+			}
+		}
+	}
+
+private:
+	enum { POLL_MS = 1000, READ_SIZE = 1 << 16 };
+
+	struct file_t {
+		std::string name;
+		int fd;
+		ino_t inode;
+		off_t offset;
+		std::string partial; // read but not yet terminated by '\n'
+	};
+
+	static std::string dir_name(const std::string &name) {
+		const size_t slash = name.rfind('/');
+		if (slash == std::string::npos) {
+			return ".";
+		}
+		return slash ? name.substr(0, slash) : "/";
+	}
+
+	// opens the file currently behind the name, returns false if there is none
+	bool reopen(file_t &f) {
+		const int fd = open(f.name.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		if (f.fd >= 0) {
+			close(f.fd);
+		}
+		f.fd = fd;
+		f.inode = st.st_ino;
+		f.offset = 0;
+		f.partial.clear();
+		return true;
+	}
+
+	void follow(file_t &f, const handler_type &handler) {
+		if (f.fd < 0 && !reopen(f)) {
+			return;
+		}
+
+		struct stat st;
+		if (fstat(f.fd, &st) == 0 && st.st_size < f.offset) {
+			// truncated in place
+			f.offset = 0;
+			f.partial.clear();
+		}
+		read_available(f, handler);
+
+		if (stat(f.name.c_str(), &st) == 0 && st.st_ino != f.inode) {
+			// rotated: the old file is read up to its end above, its last line may lack '\n'
+			if (!f.partial.empty()) {
+				f.partial += '\n';
+				handler(f.partial.data(), f.partial.size());
+			}
+			if (reopen(f)) {
+				read_available(f, handler);
+			}
+		}
+	}
+
+	void read_available(file_t &f, const handler_type &handler) {
+		char buf[READ_SIZE];
+		while (true) {
+			const ssize_t n = pread(f.fd, buf, sizeof(buf), f.offset);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				break;
+			}
+			f.offset += n;
+
+			const char *end = static_cast<const char *>(memrchr(buf, '\n', n));
+			if (!end) {
+				f.partial.append(buf, n);
+				continue;
+			}
+			++end;
+			if (f.partial.empty()) {
+				handler(buf, end - buf);
+			} else {
+				f.partial.append(buf, end - buf);
+				handler(f.partial.data(), f.partial.size());
+				f.partial.clear();
+			}
+			f.partial.append(end, buf + n - end);
+		}
+	}
+
+	// events only wake the loop up, all files are followed after every wake-up
+	void drain_events() {
+		char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+		while (read(notify_fd, buf, sizeof(buf)) > 0) {
+		}
+	}
+
+	void close_all() {
+		for (auto &f : files) {
+			if (f.fd >= 0) {
+				close(f.fd);
+			}
+		}
+		close(notify_fd);
+		close(timer_fd);
+	}
+
+	int notify_fd;
+	int timer_fd;
+	std::vector<file_t> files;
+};
+
+#endif // LOG_TAILER_HPP
@@ -1,130 +1,665 @@
 #define _XOPEN_SOURCE
 #include <iostream>
-#include <fstream>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <fstream>
+#include <future>
 #include <ctime>
 #include <cstring>
-#include <boost/tokenizer.hpp>
-#include "event_stats.hpp"
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <atomic>
+#include "sharded_event_stats.hpp"
+#include "event.hpp"
+#include "observer.hpp"
+#include "event_parser.hpp"
+#include "event_generator.hpp"
+#include "mapped_file.hpp"
+#include "event_log_format.hpp"
+#include "stats_snapshot_format.hpp"
+#include "stats_summary_format.hpp"
+#include "event_summary.hpp"
+#include "log_tailer.hpp"
+#include "top_server.hpp"
+#include "tick_clock.hpp"
 
 using namespace std;
 
+typedef sharded_event_stats<Event> EventStats;
+typedef EventStats* EventStatsPtr;
+typedef event_summary<Event> EventSummary;
 
-struct Event
+// Feeds events into event_stats, and ticks of the clock for its periodic maintenance
+class EventSerializationHandler : public IObserver, public ITickHandler
 {
-    time_t time;
-    string request;
-    string key;
-    uint64_t size;
-    uint64_t freq;
-    double freq_double;
-
-    uint64_t get_size() const { return size; }
-    void set_size(uint64_t size) { this->size = size; }
-
-    uint64_t get_freq() const { return freq; }
-    void set_freq(uint64_t freq) { this->freq = freq; }
-
-    double get_freq_double() const { return freq_double; }
-    void set_freq(double freq) { this->freq_double = freq; }
-
-    static bool size_compare(const Event &e1, const Event &e2) { return e1.size < e2.size; }
-    static bool time_compare(const Event &e1, const Event &e2) { return e1.time < e2.time; }
-    static bool freq_compare(const Event &e1, const Event &e2) { return e1.freq < e2.freq; }
-    static bool freq_double_compare(const Event &e1, const Event &e2) { return e1.freq_double < e2.freq_double; }
-    bool operator < (const Event &e) const { return key.compare( e.key ) < 0; }
+public:
+    EventSerializationHandler( EventStatsPtr event_stats )
+    : stats_( event_stats )
+    {}
+
+private:
+    // IObserver
+    virtual void NotifyObserver( const Event &event )
+    {
+        stats_->add_event( event, event.time );
+    }
+
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        stats_->add_events( events, count );
+    }
+
+    // ITickHandler
+    virtual void OnTick( time_t time )
+    {
+        stats_->tick( time );
+    }
+
+private:
+    EventStatsPtr stats_;
 };
 
-std::ostream& operator << (std::ostream& os, const Event &e)
+// Writes events out as a binary event log, see event_log_format.hpp; a block of events
+// is collected and written at a time
+class EventLogWriter : public IObserver
 {
-    os << "event = {key: " << e.key << ", request: " << e.request
-       << ", freq: " << e.freq << ", freq_d: " << e.freq_double << ", time: " << e.time << ", size: " << e.size << "}";
-    return os;
-}
+    typedef unordered_map<Event::id_type, uint64_t> Dictionary;
 
+public:
+    EventLogWriter( const char *file_name )
+    : file_name_( file_name ),
+     file_( file_name, ios::binary | ios::trunc ),
+     num_events_( 0 ),
+     last_time_( 0 )
+    {
+        string header( event_log::magic, sizeof(event_log::magic) );
+        event_log::put_uint32( header, event_log::version );
+        event_log::put_uint32( header, 0 );
+        file_.write( header.data(), header.size() );
+        if (!file_)
+            throw runtime_error( "can't write " + file_name_ );
+    }
 
-typedef event_stats<Event> EventStats;
-typedef EventStats* EventStatsPtr;
+    // Writes the last block, after the replay is over
+    void Write()
+    {
+        if (num_events_)
+            WriteBlock();
+        file_.flush();
+        if (!file_)
+            throw runtime_error( "can't write " + file_name_ );
+    }
 
-struct IObserver
-{
-    virtual void NotifyObserver( const Event &event ) = 0;
-    virtual ~IObserver() {}
+private:
+    // IObserver
+    virtual void NotifyObserver( const Event &event )
+    {
+        event_log::put_varint( times_, event_log::zigzag( event.time - last_time_ ) );
+        event_log::put_varint( requests_, DictionaryIndex( request_dict_, request_ids_, event.request ) );
+        event_log::put_varint( keys_, DictionaryIndex( key_dict_, key_ids_, event.key ) );
+        event_log::put_varint( sizes_, event.size );
+        last_time_ = event.time;
+        if (++num_events_ == event_log::block_events)
+            WriteBlock();
+    }
+
+    void WriteBlock()
+    {
+        string header;
+        event_log::put_varint( header, num_events_ );
+        WriteDictionary( header, request_ids_ );
+        WriteDictionary( header, key_ids_ );
+        for( const string *column : { &times_, &requests_, &keys_, &sizes_ } )
+        {
+            event_log::put_varint( header, column->size() );
+        }
+
+        file_.write( header.data(), header.size() );
+        for( string *column : { &times_, &requests_, &keys_, &sizes_ } )
+        {
+            file_.write( column->data(), column->size() );
+            column->clear();
+        }
+        if (!file_)
+            throw runtime_error( "can't write " + file_name_ );
+
+        request_dict_.clear();
+        key_dict_.clear();
+        request_ids_.clear();
+        key_ids_.clear();
+        num_events_ = 0;
+        last_time_ = 0;
+    }
+
+    static uint64_t DictionaryIndex( Dictionary &dict, vector<Event::id_type> &ids, Event::id_type id )
+    {
+        auto it = dict.find( id );
+        if (it != dict.end())
+            return it->second;
+        dict.emplace( id, ids.size() );
+        ids.push_back( id );
+        return ids.size() - 1;
+    }
+
+    static void WriteDictionary( string &out, const vector<Event::id_type> &ids )
+    {
+        event_log::put_varint( out, ids.size() );
+        for( auto id : ids )
+        {
+            event_log::put_varint( out, Strings().length( id ) );
+            out.append( Strings().lookup( id ), Strings().length( id ) );
+        }
+    }
+
+private:
+    string file_name_;
+    ofstream file_;
+    uint64_t num_events_;
+    time_t last_time_;
+    Dictionary request_dict_, key_dict_;
+    vector<Event::id_type> request_ids_, key_ids_;
+    string times_, requests_, keys_, sizes_;
 };
 
-struct IObservable
+// Writes events out in the CSV format EventParser reads. EventParser keeps only the client
+// address of the request field, the running number of the event is appended in its place.
+class EventCsvWriter : public IObserver
 {
-    virtual void Subscribe( IObserver *observer ) = 0;
-    virtual void NotifyAll( const Event &e ) = 0;
+public:
+    EventCsvWriter( const char *file_name, const string &zone )
+    : file_name_( file_name ),
+     file_( file_name, ios::trunc ),
+     last_time_( -1 ),
+     num_events_( 0 )
+    {
+        if (!file_)
+            throw runtime_error( "can't open " + file_name_ );
+        if (!timestamps_.set_zone( zone ))
+            throw invalid_argument( "invalid time zone: " + zone );
+    }
+
+    void Close()
+    {
+        file_.close();
+        if (!file_)
+            throw runtime_error( "can't write " + file_name_ );
+    }
+
+private:
+    // IObserver
+    virtual void NotifyObserver( const Event &event )
+    {
+        if (event.time != last_time_)
+        {
+            timestamps_.encode( event.time, timestamp_ );
+            last_time_ = event.time;
+        }
+        file_ << timestamp_ << ','
+              << Strings().lookup( event.request ) << '/' << num_events_++ << ','
+              << Strings().lookup( event.key ) << ','
+              << event.size << '\n';
+    }
+
+private:
+    string file_name_;
+    ofstream file_;
+    timestamp_decoder timestamps_;
+    time_t last_time_;
+    uint64_t num_events_;
+    char timestamp_[timestamp_decoder::TIMESTAMP_LEN + 1];
 };
 
-class Observable : virtual public IObservable
+// Snapshot of the event_stats state, see stats_snapshot_format.hpp
+class StatsSnapshot
 {
-    typedef vector<IObserver *> Container;
 public:
-    virtual void Subscribe( IObserver *observer )
+    typedef pair<const char *, size_t> StringRef;
+
+    // Exported items (errors are empty or hold the error of every item) with their keys
+    // and requests resolved: strings stay in place in the string table, so Items can be
+    // encoded on another thread while the table takes new strings
+    struct Items
+    {
+        vector<Event> items, errors;
+        vector<StringRef> keys, requests;
+    };
+
+    // Exports the state of stats in the calling thread, which must be the one feeding it
+    static void Export( EventStats &stats, Items &out )
+    {
+        stats.export_items( out.items, out.errors );
+        out.keys.reserve( out.items.size() );
+        out.requests.reserve( out.items.size() );
+        for( const auto &e : out.items )
+        {
+            out.keys.push_back( StringRef( Strings().lookup( e.key ), Strings().length( e.key ) ) );
+            out.requests.push_back( StringRef( Strings().lookup( e.request ), Strings().length( e.request ) ) );
+        }
+    }
+
+    // Encodes exported items in any thread
+    static string Encode( const Items &in )
+    {
+        const vector<Event> &items = in.items;
+        const vector<Event> &errors = in.errors;
+        time_t snapshot_time = 0;
+        for( const auto &e : items )
+        {
+            snapshot_time = max( snapshot_time, e.time );
+        }
+
+        string out( stats_snapshot::magic, sizeof(stats_snapshot::magic) );
+        event_log::put_uint32( out, stats_snapshot::version );
+        event_log::put_uint32( out, 0 );
+        event_log::put_varint( out, event_log::zigzag( snapshot_time ) );
+        event_log::put_varint( out, items.size() );
+        event_log::put_varint( out, !errors.empty() );
+        for(size_t i = 0; i < items.size(); ++i)
+        {
+            const Event &e = items[i];
+            PutString( out, in.keys[i] );
+            PutString( out, in.requests[i] );
+            event_log::put_varint( out, snapshot_time - e.time );
+            event_log::put_varint( out, e.size );
+            event_log::put_varint( out, e.freq );
+            event_log::put_uint64( out, stats_snapshot::double_bits( e.freq_double ) );
+            if (!errors.empty())
+            {
+                event_log::put_varint( out, errors[i].size );
+                event_log::put_varint( out, errors[i].freq );
+            }
+        }
+        return out;
+    }
+
+    // Writes into a temporary file renamed over file_name, so a crash leaves the previous snapshot intact
+    static void Write( const string &file_name, const string &data )
     {
-        observers_.push_back( observer );
+        const string tmp_name = file_name + ".tmp";
+        {
+            ofstream file( tmp_name.c_str(), ios::binary | ios::trunc );
+            file.write( data.data(), data.size() );
+            file.flush();
+            if (!file)
+                throw runtime_error( "can't write " + tmp_name );
+        }
+        if (rename( tmp_name.c_str(), file_name.c_str() ))
+            throw runtime_error( "can't rename " + tmp_name + ": " + strerror( errno ) );
     }
-    virtual void NotifyAll( const Event &event )
+
+    static void Load( const char *file_name, EventStats &stats )
     {
-        for( auto observer : observers_ )
+        mapped_file file( file_name );
+        if (!stats_snapshot::has_magic( file.data(), file.size() ))
+            throw runtime_error( string( file_name ) + " is not a snapshot" );
+
+        event_log::cursor cursor( file.data(), file.data() + file.size() );
+        cursor.bytes( sizeof(stats_snapshot::magic) );
+        const uint32_t version = cursor.uint32();
+        if (version < 1 || version > stats_snapshot::version)
+            throw runtime_error( "snapshot: unsupported version " + to_string( version ) );
+        cursor.uint32();
+
+        const time_t snapshot_time = event_log::unzigzag( cursor.varint() );
+        const uint64_t count = cursor.varint();
+        const bool has_errors = version >= 2 && cursor.varint();
+        vector<Event> items, errors;
+        items.reserve( count );
+        for(uint64_t i = 0; i < count; ++i)
         {
-            observer->NotifyObserver( event );
+            Event e;
+            e.key = GetString( cursor );
+            e.request = GetString( cursor );
+            e.time = snapshot_time - cursor.varint();
+            e.size = cursor.varint();
+            e.freq = cursor.varint();
+            e.freq_double = stats_snapshot::bits_double( cursor.uint64() );
+            items.push_back( e );
+            if (has_errors)
+            {
+                Event error( e );
+                error.size = cursor.varint();
+                error.freq = cursor.varint();
+                error.freq_double = 0.;
+                errors.push_back( error );
+            }
         }
+        if (!items.empty())
+            stats.import_items( &items[0], has_errors ? &errors[0] : nullptr, items.size() );
+    }
+
+    static void EncodeAndWrite( const string &file_name, const Items &items )
+    {
+        Write( file_name, Encode( items ) );
     }
+
 private:
-    Container observers_;
+    static void PutString( string &out, const StringRef &s )
+    {
+        event_log::put_varint( out, s.second );
+        out.append( s.first, s.second );
+    }
+
+    static Event::id_type GetString( event_log::cursor &cursor )
+    {
+        const uint64_t len = cursor.varint();
+        return Strings().intern( cursor.bytes( len ), len );
+    }
 };
 
-class EventSerializationHandler : public IObserver
+// Checkpoints event_stats every interval seconds of event time. Items are exported between
+// events, which copies them and their string references; encoding and writing the file is
+// left to a background thread. A checkpoint is skipped while the previous one is still
+// being written.
+class EventSnapshotHandler : public IObserver
 {
 public:
-    EventSerializationHandler( EventStatsPtr event_stats )
-    : stats_( event_stats )
+    EventSnapshotHandler( EventStatsPtr event_stats, const char *file_name, int interval_in_seconds )
+    : stats_( event_stats ),
+     file_name_( file_name ),
+     interval_( interval_in_seconds ),
+     next_checkpoint_( 0 )
     {}
 
+    // Synchronous checkpoint, after the replay is over
+    void Save()
+    {
+        Wait();
+        StatsSnapshot::Items items;
+        StatsSnapshot::Export( *stats_, items );
+        StatsSnapshot::EncodeAndWrite( file_name_, items );
+    }
+
+    // Waits for the checkpoint being written, if any, it refers to strings of the table
+    void Wait()
+    {
+        if (!pending_.valid())
+            return;
+        try
+        {
+            pending_.get();
+        }
+        catch(exception &e)
+        {
+            cerr << "checkpoint failed: " << e.what() << endl;
+        }
+    }
+
 private:
     // IObserver
     virtual void NotifyObserver( const Event &event )
     {
-        stats_->add_event( event, event.time );
+        if (!next_checkpoint_)
+            next_checkpoint_ = event.time + interval_;
+
+        if (event.time >= next_checkpoint_)
+        {
+            next_checkpoint_ = event.time + interval_;
+            if (pending_.valid() && pending_.wait_for( chrono::seconds(0) ) != future_status::ready)
+                return;
+
+            Wait();
+            StatsSnapshot::Items items;
+            StatsSnapshot::Export( *stats_, items );
+            pending_ = async( launch::async, &StatsSnapshot::EncodeAndWrite, file_name_, std::move( items ) );
+        }
     }
 
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        // all events but the last one share the time of the previous batch
+        NotifyObserver( events[count - 1] );
+    }
+
+
 private:
     EventStatsPtr stats_;
+    string file_name_;
+    int interval_;
+    time_t next_checkpoint_;
+    future<void> pending_;
 };
 
-class EventStatisticsHandler : public IObserver
+// event_summary file, see stats_summary_format.hpp
+class SummaryFile
 {
 public:
-    EventStatisticsHandler( EventStatsPtr event_stats )
+    static void Write( const string &file_name, const EventSummary &summary )
+    {
+        string out( stats_summary::magic, sizeof(stats_summary::magic) );
+        event_log::put_uint32( out, stats_summary::version );
+        event_log::put_uint32( out, summary.freq_compare() == &Event::freq_double_compare ? stats_summary::flag_freq_double : 0 );
+        event_log::put_varint( out, summary.get_capacity() );
+        PutList( out, summary.size_list(), summary.get_size_bound() );
+        PutList( out, summary.freq_list(), summary.get_freq_bound() );
+
+        ofstream file( file_name.c_str(), ios::binary | ios::trunc );
+        file.write( out.data(), out.size() );
+        if (!file)
+            throw runtime_error( "can't write " + file_name );
+    }
+
+    static EventSummary Load( const char *file_name )
+    {
+        mapped_file file( file_name );
+        if (!stats_summary::has_magic( file.data(), file.size() ))
+            throw runtime_error( string( file_name ) + " is not a summary" );
+
+        event_log::cursor cursor( file.data(), file.data() + file.size() );
+        cursor.bytes( sizeof(stats_summary::magic) );
+        const uint32_t version = cursor.uint32();
+        if (version != stats_summary::version)
+            throw runtime_error( "summary: unsupported version " + to_string( version ) );
+        const uint32_t flags = cursor.uint32();
+
+        const size_t capacity = cursor.varint();
+        EventSummary summary( capacity, flags & stats_summary::flag_freq_double ? &Event::freq_double_compare : &Event::freq_compare );
+        GetList( cursor, summary.size_list(), summary.get_size_bound() );
+        GetList( cursor, summary.freq_list(), summary.get_freq_bound() );
+        return summary;
+    }
+
+private:
+    static void PutCounters( string &out, const Event &e )
+    {
+        event_log::put_varint( out, e.size );
+        event_log::put_varint( out, e.freq );
+        event_log::put_uint64( out, stats_snapshot::double_bits( e.freq_double ) );
+    }
+
+    static void GetCounters( event_log::cursor &cursor, Event &e )
+    {
+        e.size = cursor.varint();
+        e.freq = cursor.varint();
+        e.freq_double = stats_snapshot::bits_double( cursor.uint64() );
+    }
+
+    static void PutString( string &out, Event::id_type id )
+    {
+        event_log::put_varint( out, Strings().length( id ) );
+        out.append( Strings().lookup( id ), Strings().length( id ) );
+    }
+
+    static Event::id_type GetString( event_log::cursor &cursor )
+    {
+        const uint64_t len = cursor.varint();
+        return Strings().intern( cursor.bytes( len ), len );
+    }
+
+    static void PutList( string &out, const EventSummary::list_type &list, const Event &bound )
+    {
+        PutCounters( out, bound );
+        event_log::put_varint( out, list.size() );
+        for( const auto &en : list )
+        {
+            PutString( out, en.value.key );
+            PutString( out, en.value.request );
+            event_log::put_varint( out, event_log::zigzag( en.value.time ) );
+            PutCounters( out, en.value );
+            PutCounters( out, en.error );
+        }
+    }
+
+    static void GetList( event_log::cursor &cursor, EventSummary::list_type &list, Event &bound )
+    {
+        GetCounters( cursor, bound );
+        const uint64_t count = cursor.varint();
+        list.clear();
+        list.reserve( count );
+        for(uint64_t i = 0; i < count; ++i)
+        {
+            EventSummary::entry en = EventSummary::entry();
+            en.value.key = GetString( cursor );
+            en.value.request = GetString( cursor );
+            en.value.time = event_log::unzigzag( cursor.varint() );
+            GetCounters( cursor, en.value );
+            GetCounters( cursor, en.error );
+            list.push_back( en );
+        }
+    }
+};
+
+// Drops the strings no item of event_stats refers to any more, so that the string table
+// of the daemon doesn't keep every key and request ever seen. Runs on a tick, between
+// events, once the table holds twice as many strings as the previous collection kept.
+// A freed id may go to a new key, which then inherits the estimates the tinylfu sketch
+// made for the old one, as a hash collision would.
+class StringCollector : public ITickHandler
+{
+public:
+    // snapshot may be null
+    StringCollector( EventStatsPtr event_stats, EventSnapshotHandler *snapshot )
     : stats_( event_stats ),
-     last_event_time_(0),
-     max_freq(0)
+     snapshot_( snapshot ),
+     threshold_( MIN_STRINGS )
+    {}
+
+private:
+    enum { MIN_STRINGS = 1 << 16 };
+
+    // ITickHandler
+    virtual void OnTick( time_t time )
+    {
+        string_table &strings = Strings();
+        if (strings.count() < threshold_)
+            return;
+
+        // a checkpoint being written refers to strings of the table
+        if (snapshot_)
+            snapshot_->Wait();
+
+        vector<bool> live( strings.size(), false );
+        stats_->for_each_item( [&live]( const Event &e ) { live[e.key] = true; live[e.request] = true; } );
+        strings.collect( live );
+        threshold_ = max<size_t>( 2 * strings.count(), MIN_STRINGS );
+    }
+
+private:
+    EventStatsPtr stats_;
+    EventSnapshotHandler *snapshot_;
+    size_t threshold_;
+};
+
+// Writes the summary of event_stats as of the last event, after the replay
+class EventSummaryWriter : public IObserver
+{
+public:
+    EventSummaryWriter( EventStatsPtr event_stats, const char *file_name, size_t capacity, int period )
+    : stats_( event_stats ),
+     file_name_( file_name ),
+     capacity_( capacity ),
+     period_( period ),
+     last_event_time_( 0 )
     {}
 
+    void Write()
+    {
+        SummaryFile::Write( file_name_, EventSummary::from_stats( *stats_, capacity_, period_, last_event_time_ ) );
+    }
+
 private:
     // IObserver
     virtual void NotifyObserver( const Event &event )
     {
-        if (!last_event_time_)
-            last_event_time_ = event.time;
+        last_event_time_ = event.time;
+    }
 
-        if ( event.time - last_event_time_ >= 1 ) // every second
-        {
-            // if more than one second elapsed since last event, then insert fake events
-            // and GetTop for those 'missed' seconds
-            const int num_fake_events = event.time - last_event_time_ - 1;
-            for(int i = 1; i <= num_fake_events; ++i)
-            {
-                const time_t missed_second = last_event_time_ + i;
-                GetTop( missed_second );
-            }
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        last_event_time_ = events[count - 1].time;
+    }
 
-            GetTop(event.time);
-            last_event_time_ = event.time;
-        }
+private:
+    EventStatsPtr stats_;
+    string file_name_;
+    size_t capacity_;
+    int period_;
+    time_t last_event_time_;
+};
+
+// Merges summaries of several nodes and prints the global top with error bounds
+static void MergeSummaries( const vector<const char *> &file_names, const char *output_name )
+{
+    vector<EventSummary> summaries;
+    for( auto file_name : file_names )
+    {
+        summaries.push_back( SummaryFile::Load( file_name ) );
+    }
+    EventSummary::merge_tree( summaries );
+    const EventSummary &summary = summaries[0];
+
+    if (output_name)
+        SummaryFile::Write( output_name, summary );
+
+    typedef vector<EventSummary::entry> EntryContainer;
+    EntryContainer top_size, top_freq;
+    summary.get_top( 50, top_size, top_freq );
+
+    int i = 0;
+    cout << "top by size" << '\n';
+    for( const auto &en : top_size )
+    {
+        cout << i++ << ' ' << en.value << " size_error: " << en.error.size << '\n';
+    }
+    cout << "size_bound= " << summary.get_size_bound().size << '\n';
+
+    i = 0;
+    cout << "top by frequency" << '\n';
+    for( const auto &en : top_freq )
+    {
+        cout << i++ << ' ' << en.value << " freq_error: " << en.error.freq << ", freq_d_error: " << en.error.freq_double << '\n';
+    }
+    cout << "freq_bound= " << summary.get_freq_bound().freq << ", freq_d_bound= " << summary.get_freq_bound().freq_double << endl;
+}
+
+// Prints the top every second, of the longest window and then of the shorter ones
+class EventStatisticsHandler : public ITickHandler
+{
+    typedef vector<Event> EventContainer;
+
+public:
+    // windows are ascending
+    EventStatisticsHandler( EventStatsPtr event_stats, const vector<int> &windows )
+    : stats_( event_stats ),
+     windows_( windows ),
+     max_freq(0)
+    {}
+
+    // Shadow stats are fed the same events elsewhere, every second their top is
+    // compared with the top of the primary stats
+    void AddShadow( const string &name, EventStatsPtr event_stats )
+    {
+        shadows_.push_back( make_pair( name, event_stats ) );
+    }
+
+private:
+    // ITickHandler
+    virtual void OnTick( time_t time )
+    {
+        GetTop( time );
     }
 
     void GetTop( time_t current_time )
@@ -133,9 +668,8 @@ private:
         int intersect = 0;
         int i = 0;
 
-        typedef vector<Event> EventContainer;
         EventContainer top_size, top_freq;
-        stats_->get_top(50, 5*60, current_time, top_size, top_freq);
+        stats_->get_top(50, windows_.back(), current_time, top_size, top_freq);
 
         //PrintTopKeys( top_size ); return;
 
@@ -167,6 +701,51 @@ private:
         cout << "intersect= " << intersect << '\n';
         cout << "max_freq= " << max_freq << '\n';
         cout << total_size << endl;
+
+        for( const auto &shadow : shadows_ )
+        {
+            EventContainer shadow_size, shadow_freq;
+            shadow.second->get_top(50, windows_.back(), current_time, shadow_size, shadow_freq);
+            cout << "shadow " << shadow.first << ": size_overlap= " << Overlap( top_size, shadow_size ) << '/' << top_size.size()
+                 << ", freq_overlap= " << Overlap( top_freq, shadow_freq ) << '/' << top_freq.size() << endl;
+        }
+
+        for(size_t w = 0; w + 1 < windows_.size(); ++w)
+        {
+            EventContainer window_size, window_freq;
+            stats_->get_top(50, windows_[w], current_time, window_size, window_freq);
+
+            cout << "window= " << windows_[w] << '\n';
+            cout << "top by size" << '\n';
+            i = 0;
+            for( const auto& e : window_size )
+            {
+                cout << i++ << ' ' << e << '\n';
+            }
+            cout << "top by frequency" << '\n';
+            i = 0;
+            for( const auto& e : window_freq )
+            {
+                cout << i++ << ' ' << e << '\n';
+            }
+            cout << flush;
+        }
+    }
+
+    // number of keys of top found in other
+    static size_t Overlap( const EventContainer &top, const EventContainer &other )
+    {
+        unordered_set<Event::id_type> keys;
+        for( const auto &e : other )
+        {
+            keys.insert( e.key );
+        }
+        size_t n = 0;
+        for( const auto &e : top )
+        {
+            n += keys.count( e.key );
+        }
+        return n;
     }
 
     template<typename Container>
@@ -174,92 +753,398 @@ private:
     {
         for( const auto& e : top_size )
         {
-            cout << e.key << '\n';
+            cout << Strings().lookup( e.key ) << '\n';
         }
         cout << "***" << endl;
     }
 
 private:
     EventStatsPtr stats_;
-    time_t last_event_time_;
+    vector<int> windows_;
+    vector< pair<string, EventStatsPtr> > shadows_;
     uint64_t max_freq;
 };
 
-class EventParser : public Observable
+// Publishes the top of event_stats in every window for the queries of the daemon mode on every tick
+class EventPublishHandler : public ITickHandler
 {
+    typedef vector<Event> EventContainer;
+
 public:
-    void Parse(const char *file_name)
+    // windows are ascending
+    EventPublishHandler( EventStatsPtr event_stats, TopPublisher *publisher, const vector<int> &windows )
+    : stats_( event_stats ),
+     publisher_( publisher ),
+     windows_( windows )
+    {}
+
+private:
+    // ITickHandler
+    virtual void OnTick( time_t time )
+    {
+        Publish( time );
+    }
+
+    void Publish( time_t current_time )
     {
-        ifstream file(file_name);
-        string line;
-        unsigned line_num = 0;
-        size_t pos;
-        struct std::tm tm;
+        unique_ptr<TopSnapshot> snapshot( new TopSnapshot );
+        snapshot->time = current_time;
+        snapshot->windows.resize( windows_.size() );
+        for(size_t w = 0; w < windows_.size(); ++w)
+        {
+            EventContainer top_size, top_freq;
+            stats_->get_top(50, windows_[w], current_time, top_size, top_freq);
 
-        typedef boost::char_separator<char> Separator;
-        Separator sep(",");
+            TopSnapshot::Window &window = snapshot->windows[w];
+            window.period = windows_[w];
+            Copy( top_size, window.top_size );
+            Copy( top_freq, window.top_freq );
+        }
+        publisher_->publish( snapshot.release() );
+    }
 
-        Event event;
-        event.freq = 1;
-        event.freq_double = 1.;
-        while( getline( file, line ) )
+    static void Copy( const EventContainer &top, vector<TopSnapshot::Entry> &entries )
+    {
+        entries.reserve( top.size() );
+        for( const auto &e : top )
         {
-            boost::tokenizer<Separator> tokens(line, sep);
-            int tok_number = 0;
-            for( auto& t : tokens ) {
-                switch(tok_number) {
-                    case 0:
-                        memset(&tm, 0, sizeof(struct std::tm));
-                        strptime(t.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
-                        event.time = mktime(&tm);
-                        break;
-                    case 1:
-                        pos = t.find('/');
-                        if (pos != string::npos)
-                            event.request = std::move( string(t,0,pos) );
-                        else
-                            event.request.clear();
-                        break;
-                    case 2:
-                        event.key = move(t);
-                        break;
-                    case 3:
-                        event.size = stoull(t);
-                        break;
+            TopSnapshot::Entry entry;
+            entry.key.assign( Strings().lookup( e.key ), Strings().length( e.key ) );
+            entry.request.assign( Strings().lookup( e.request ), Strings().length( e.request ) );
+            entry.size = e.size;
+            entry.freq = e.freq;
+            entry.freq_double = e.freq_double;
+            entry.time = e.time;
+            entries.push_back( entry );
+        }
+    }
+
+private:
+    EventStatsPtr stats_;
+    TopPublisher *publisher_;
+    vector<int> windows_;
+};
+
+static atomic<bool> stop_requested( false );
+
+static void RequestStop( int )
+{
+    stop_requested.store( true );
+}
+
+// Follows the files and ingests their new lines until SIGINT or SIGTERM, meanwhile the
+// top published by evPublish is served on the socket. The clock is ticked every second
+// of wall clock time, whether lines come or not. Lines of several files are ingested in
+// the order they are read, the files are not merged by time as in a replay.
+static void RunDaemon( EventParser &parser, const vector<const char *> &file_names, bool node_log,
+                       bool from_start, const char *socket_name, TopPublisher &publisher,
+                       DaemonClock &clock )
+{
+    log_tailer tailer( file_names, from_start );
+    TopServer server( socket_name, publisher );
+
+    // no SA_RESTART: a signal interrupts the wait of the tailer
+    struct sigaction action;
+    memset( &action, 0, sizeof(action) );
+    action.sa_handler = &RequestStop;
+    sigaction( SIGINT, &action, nullptr );
+    sigaction( SIGTERM, &action, nullptr );
+
+    tailer.run( stop_requested,
+                [&parser, node_log]( const char *data, size_t size ) { parser.ParseText( data, size, node_log ); },
+                [&clock]( time_t time ) { clock.Tick( time ); } );
+}
+
+static void Usage(const char *prog)
+{
+    cerr << "usage: " << prog << " [-t strategy[,shadow...]] [-z local|utc|+HHMM] [-j threads] [-p threads] [-l] [-c event_log]" << endl
+         << "       [-r snapshot] [-s snapshot] [-i seconds] [-e summary] [-k capacity] [-M] [-g spec] [-o csv]" << endl
+         << "       [-w seconds[,seconds...]] [-d socket [-b]] file..." << endl
+         << "  -t  event_stats strategy: " << EventStats::shard_t::strategy_names() << "; lru by default." << endl
+         << "      Strategies after the first one are shadows fed the same events, their top is compared" << endl
+         << "      with the top of the first one every second (not with -d)" << endl
+         << "  -z  time zone of the log timestamps, local by default" << endl
+         << "  -j  number of event_stats shards, each ingested by its own thread" << endl
+         << "  -p  number of threads parsing the file in chunks, for a single CSV file" << endl
+         << "  -l  files are Elliptics node logs (gzip or plain), not CSV files" << endl
+         << "  -c  convert the input into a binary event log instead of computing statistics," << endl
+         << "      a single binary event log is accepted as input in place of a CSV file" << endl
+         << "  -r  restore event_stats from a snapshot before the replay, not with the slices strategy" << endl
+         << "  -s  checkpoint event_stats into a snapshot periodically and after the replay," << endl
+         << "      not with the slices strategy" << endl
+         << "  -i  checkpoint interval in seconds of event time, 60 by default" << endl
+         << "  -e  write a mergeable summary of event_stats after the replay; its error bounds cover" << endl
+         << "      merging only, the counts are exact for the simple strategy alone" << endl
+         << "  -k  number of keys per summary list, 1000 by default" << endl
+         << "  -M  files are summaries: merge them and print the global top, -e writes the merged summary" << endl
+         << "  -g  replay a synthetic workload instead of files, spec is name=value,... of" << endl
+         << "      events, keys, zipf, rate, start, size_mu, size_sigma, clients, client_zipf," << endl
+         << "      burst_rate, burst_length, burst_share, drift_interval, drift, seed (see event_generator.hpp)" << endl
+         << "  -o  also write the replayed events into a CSV file" << endl
+         << "  -w  windows of the top in seconds, 300 by default; the longest one is the period of event_stats," << endl
+         << "      the top of the shorter ones is printed (and served) after it, all of them from the same event_stats" << endl
+         << "  -d  daemon mode: follow the files as they grow (and get rotated) instead of replaying them," << endl
+         << "      and answer \"top [k] [size|freq] [<window>s]\" lines on the Unix socket with JSON, until SIGINT or SIGTERM;" << endl
+         << "      the top is taken every second of wall clock time, or of the newest event if the log" << endl
+         << "      timestamps run ahead of it (by less than 15 hours); -s and -e output is written on exit." << endl
+         << "      Lines of several files are ingested in the order they are read, not merged by time," << endl
+         << "      so the daemon is meant to follow one file" << endl
+         << "  -b  in daemon mode, ingest what the files already hold too, not only new lines;" << endl
+         << "      the backlog is read before the first tick, so lines older than the period expire right away" << endl
+         << "several files, each ordered by time, are merged by time while being replayed (not with -d)" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    vector<string> strategies;
+    string zone = "local";
+    size_t num_threads = 0;
+    size_t num_parse_threads = 1;
+    bool node_log = false;
+    const char *event_log_name = nullptr;
+    const char *restore_name = nullptr;
+    const char *snapshot_name = nullptr;
+    int snapshot_interval = 60;
+    const char *summary_name = nullptr;
+    size_t summary_capacity = 1000;
+    bool merge_summaries = false;
+    unique_ptr<GeneratorConfig> generator_config;
+    const char *csv_name = nullptr;
+    const char *socket_name = nullptr;
+    bool from_start = false;
+    vector<int> windows;
+    int opt;
+    while( ( opt = getopt( argc, argv, "t:z:j:p:lc:r:s:i:e:k:Mg:o:w:d:b" ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 't':
+            {
+                istringstream names( optarg );
+                string name;
+                while( getline( names, name, ',' ) )
+                {
+                    strategies.push_back( name );
                 }
-                ++tok_number;
+                break;
             }
-
-            if ( tok_number == 4 ) {
-                NotifyAll( event );
-            } else {
-                cerr << "failed parse line: " << line_num << ": " << line << endl;
+            case 'z':
+                zone = optarg;
+                break;
+            case 'j':
+                num_threads = atoi( optarg );
+                break;
+            case 'p':
+                num_parse_threads = max( atoi( optarg ), 1 );
+                break;
+            case 'l':
+                node_log = true;
+                break;
+            case 'c':
+                event_log_name = optarg;
+                break;
+            case 'r':
+                restore_name = optarg;
+                break;
+            case 's':
+                snapshot_name = optarg;
+                break;
+            case 'i':
+                snapshot_interval = max( atoi( optarg ), 1 );
+                break;
+            case 'e':
+                summary_name = optarg;
+                break;
+            case 'k':
+                summary_capacity = max( atoi( optarg ), 1 );
+                break;
+            case 'M':
+                merge_summaries = true;
+                break;
+            case 'g':
+                generator_config.reset( new GeneratorConfig );
+                try
+                {
+                    generator_config->Parse( optarg );
+                }
+                catch(exception &e)
+                {
+                    cerr << e.what() << endl;
+                    return 1;
+                }
+                break;
+            case 'o':
+                csv_name = optarg;
+                break;
+            case 'w':
+            {
+                istringstream seconds( optarg );
+                string window;
+                while( getline( seconds, window, ',' ) )
+                {
+                    if (atoi( window.c_str() ) <= 0) {
+                        cerr << "window in seconds expected: " << window << endl;
+                        return 1;
+                    }
+                    windows.push_back( atoi( window.c_str() ) );
+                }
                 break;
             }
-
-            ++line_num;
+            case 'd':
+                socket_name = optarg;
+                break;
+            case 'b':
+                from_start = true;
+                break;
+            default:
+                Usage( argv[0] );
+                return 1;
         }
     }
-};
 
+    if (strategies.empty())
+        strategies.push_back( "lru" );
 
-int main(int argc, const char* argv[])
-{
-    if (argc < 2) {
+    if (windows.empty())
+        windows.push_back( 5 * 60 );
+    sort( windows.begin(), windows.end() );
+    windows.erase( unique( windows.begin(), windows.end() ), windows.end() );
+    const int period = windows.back();
+
+    // -c only converts, there would be no top to serve
+    if (socket_name && (generator_config || merge_summaries || event_log_name)) {
+        cerr << "-d can't be combined with -g, -M or -c" << endl;
+        Usage( argv[0] );
+        return 1;
+    }
+
+    // shadows are compared on stdout every second, the daemon answers on its socket only
+    if (socket_name && strategies.size() > 1) {
+        cerr << "-d can't be combined with shadow strategies" << endl;
+        Usage( argv[0] );
+        return 1;
+    }
+
+    // other inputs are read by a single thread
+    if (num_parse_threads > 1 && (node_log || argc - optind > 1 || generator_config || merge_summaries || socket_name)) {
+        cerr << "-p needs a single CSV file and can't be combined with -l, -g, -M or -d" << endl;
+        Usage( argv[0] );
+        return 1;
+    }
+
+    // top_slices keeps per-second tops, not items that could be restored
+    if ((snapshot_name || restore_name) && strategies[0] == "slices") {
+        cerr << "-s and -r can't be used with the slices strategy" << endl;
+        Usage( argv[0] );
+        return 1;
+    }
+
+    if (optind >= argc && !generator_config) {
         cerr << "file name argument expected" << endl;
+        Usage( argv[0] );
         return 1;
     }
 
     try
     {
-        EventStats stats(10 * 1000, 50, 5 * 60);
+        if (merge_summaries)
+        {
+            MergeSummaries( vector<const char *>( argv + optind, argv + argc ), summary_name );
+            return 0;
+        }
+
+        EventStats stats(strategies[0], 10 * 1000, 50, period, num_threads, windows);
         EventSerializationHandler evSerialization(&stats);
-        EventStatisticsHandler evStats(&stats);
+        EventStatisticsHandler evStats(&stats, windows);
+        vector< unique_ptr<EventStats> > shadows;
+        vector< unique_ptr<EventSerializationHandler> > shadowSerialization;
+        unique_ptr<EventLogWriter> evLog;
+        unique_ptr<EventSnapshotHandler> evSnapshot;
+        unique_ptr<EventSummaryWriter> evSummary;
+        unique_ptr<EventCsvWriter> evCsv;
+        unique_ptr<StringCollector> stringCollector;
+        TopPublisher publisher;
+        EventPublishHandler evPublish(&stats, &publisher, windows);
+        vector<ITickHandler *> tickHandlers;
+        ReplayClock replayClock;
+        DaemonClock daemonClock;
 
         EventParser parser;
-        parser.Subscribe( &evSerialization );
-        parser.Subscribe( &evStats );
-        parser.Parse(argv[1]);
+        if ( !parser.SetTimeZone( zone ) ) {
+            cerr << "invalid time zone: " << zone << endl;
+            return 1;
+        }
+        unique_ptr<EventGenerator> generator;
+        if (generator_config)
+            generator.reset( new EventGenerator( *generator_config ) );
+        IObservable &source = generator ? static_cast<IObservable &>( *generator ) : parser;
+
+        if (csv_name) {
+            evCsv.reset( new EventCsvWriter( csv_name, zone ) );
+            source.Subscribe( evCsv.get() );
+        }
+        if (event_log_name) {
+            evLog.reset( new EventLogWriter( event_log_name ) );
+            source.Subscribe( evLog.get() );
+        } else {
+            if (restore_name)
+                StatsSnapshot::Load( restore_name, stats );
+            source.Subscribe( &evSerialization );
+            tickHandlers.push_back( &evSerialization );
+            if (snapshot_name) {
+                evSnapshot.reset( new EventSnapshotHandler( &stats, snapshot_name, snapshot_interval ) );
+                source.Subscribe( evSnapshot.get() );
+            }
+            if (summary_name) {
+                evSummary.reset( new EventSummaryWriter( &stats, summary_name, summary_capacity, period ) );
+                source.Subscribe( evSummary.get() );
+            }
+            // shadows are compared over the period only, they need no shorter windows
+            for(size_t i = 1; i < strategies.size(); ++i) {
+                shadows.emplace_back( new EventStats( strategies[i], 10 * 1000, 50, period, num_threads ) );
+                shadowSerialization.emplace_back( new EventSerializationHandler( shadows.back().get() ) );
+                source.Subscribe( shadowSerialization.back().get() );
+                tickHandlers.push_back( shadowSerialization.back().get() );
+                evStats.AddShadow( strategies[i], shadows.back().get() );
+            }
+            if (socket_name) {
+                tickHandlers.push_back( &evPublish );
+                stringCollector.reset( new StringCollector( &stats, evSnapshot.get() ) );
+                tickHandlers.push_back( stringCollector.get() );
+            } else
+                tickHandlers.push_back( &evStats );
+        }
+
+        // a replay is ticked by the time of its events, the daemon by the wall clock
+        if (!socket_name) {
+            for( auto handler : tickHandlers )
+                replayClock.Subscribe( handler );
+            source.Subscribe( &replayClock );
+        } else {
+            for( auto handler : tickHandlers )
+                daemonClock.Subscribe( handler );
+            source.Subscribe( &daemonClock );
+        }
+
+        if (socket_name)
+            RunDaemon( parser, vector<const char *>( argv + optind, argv + argc ), node_log, from_start, socket_name, publisher, daemonClock );
+        else if (generator)
+            generator->Generate();
+        else if (node_log || argc - optind > 1)
+            parser.ParseMerged( vector<const char *>( argv + optind, argv + argc ), node_log );
+        else if (num_parse_threads > 1)
+            parser.ParseParallel( argv[optind], num_parse_threads );
+        else
+            parser.Parse( argv[optind] );
+
+        if (evCsv)
+            evCsv->Close();
+        if (evLog)
+            evLog->Write();
+        if (evSnapshot)
+            evSnapshot->Save();
+        if (evSummary)
+            evSummary->Write();
     }
     catch(exception &e)
     {
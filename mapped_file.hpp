@@ -0,0 +1,67 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <stdexcept>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file.
+class mapped_file {
+
+public:
+	explicit mapped_file(const char *file_name)
+	: addr(NULL), length(0) {
+		int fd = open(file_name, O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error(std::string("can't open ") + file_name + ": " + strerror(errno));
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			int err = errno;
+			close(fd);
+			throw std::runtime_error(std::string("can't stat ") + file_name + ": " + strerror(err));
+		}
+
+		length = st.st_size;
+		if (length) {
+			void *p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				int err = errno;
+				close(fd);
+				throw std::runtime_error(std::string("can't mmap ") + file_name + ": " + strerror(err));
+			}
+			addr = static_cast<const char *>(p);
+			madvise(p, length, MADV_SEQUENTIAL);
+		}
+		close(fd);
+	}
+
+	~mapped_file() {
+		if (addr) {
+			munmap(const_cast<char *>(addr), length);
+		}
+	}
+
+	const char *data() const {
+		return addr;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+	mapped_file(const mapped_file &);
+	mapped_file &operator =(const mapped_file &);
+
+	const char *addr;
+	size_t length;
+};
+
+#endif // MAPPED_FILE_HPP
@@ -0,0 +1,56 @@
+#ifndef OBJECT_POOL_HPP
+#define OBJECT_POOL_HPP
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Fixed-capacity pool of objects of type T.
+// All storage is allocated at construction, create/destroy only pop and push
+// a free list, so a full pool in steady state does no heap allocations.
+// Objects still alive when the pool goes away are not destructed.
+template<typename T>
+class object_pool {
+
+public:
+	explicit object_pool(size_t capacity)
+	: storage( new slot_t[capacity] ) {
+		free_slots.reserve(capacity);
+		for (size_t i = capacity; i > 0; --i) {
+			free_slots.push_back( reinterpret_cast<T*>(&storage[i - 1]) );
+		}
+	}
+
+	template<typename... Args>
+	T *create(Args&&... args) {
+		if (free_slots.empty()) {
+			throw std::bad_alloc();
+		}
+		T *p = free_slots.back();
+		free_slots.pop_back();
+		return new (p) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T *p) {
+		p->~T();
+		free_slots.push_back(p);
+	}
+
+	// slot number of an object of the pool, in [0, capacity)
+	size_t index(const T *p) const {
+		return reinterpret_cast<const slot_t *>(p) - storage.get();
+	}
+
+	size_t available() const {
+		return free_slots.size();
+	}
+
+private:
+	typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type slot_t;
+
+	std::unique_ptr<slot_t[]> storage;
+	std::vector<T*> free_slots;
+};
+
+#endif // OBJECT_POOL_HPP
@@ -0,0 +1,72 @@
+#ifndef OBSERVER_HPP
+#define OBSERVER_HPP
+
+#include <vector>
+#include "event.hpp"
+
+struct IObserver
+{
+    virtual void NotifyObserver( const Event &event ) = 0;
+    // Events of a batch are ordered as they would be notified one by one,
+    // only the last one may start a new second (see Observable::NotifyBatch)
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            NotifyObserver( events[i] );
+        }
+    }
+    virtual ~IObserver() {}
+};
+
+struct IObservable
+{
+    virtual void Subscribe( IObserver *observer ) = 0;
+    virtual void NotifyAll( const Event &e ) = 0;
+    virtual void NotifyBatch( const Event *events, size_t count ) = 0;
+};
+
+class Observable : virtual public IObservable
+{
+    typedef vector<IObserver *> Container;
+public:
+    Observable()
+    : last_time_(0)
+    {}
+
+    virtual void Subscribe( IObserver *observer )
+    {
+        observers_.push_back( observer );
+    }
+    virtual void NotifyAll( const Event &event )
+    {
+        for( auto observer : observers_ )
+        {
+            observer->NotifyObserver( event );
+        }
+        last_time_ = event.time;
+    }
+    // The batch is cut right after every event that changes the time, so observers acting
+    // on second boundaries see exactly the state they would see with NotifyAll per event.
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        size_t start = 0;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if (events[i].time != last_time_ || i + 1 == count)
+            {
+                for( auto observer : observers_ )
+                {
+                    observer->NotifyBatch( events + start, i + 1 - start );
+                }
+                start = i + 1;
+            }
+            last_time_ = events[i].time;
+        }
+    }
+private:
+    Container observers_;
+    time_t last_time_;
+};
+
+#endif // OBSERVER_HPP
@@ -0,0 +1,164 @@
+#ifndef RCU_POINTER_HPP
+#define RCU_POINTER_HPP
+
+#include <atomic>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+
+// Pointer to an immutable object, replaced by one writer thread and read by any number
+// of reader threads without locks (read-copy-update). Replaced objects are reclaimed
+// by epochs: a reader announces the global epoch in its slot for the time it uses the
+// object, the writer retires the replaced object with the current epoch and bumps it,
+// and deletes a retired object once no slot announces an epoch at or before its retirement.
+// A reader can only have loaded the replaced pointer if it announced before the swap,
+// i.e. an epoch not after the retirement one.
+//
+// Readers neither wait nor write shared state other than their own slot; the writer
+// never waits for readers either, objects still in use stay on the retired list until
+// a later publish. A reader is a registered slot, at most MAX_READERS exist at a time.
+template<typename T>
+class rcu_pointer {
+
+	struct slot_t;
+
+public:
+	enum { MAX_READERS = 64 };
+
+	// Slot of one reader thread, a reader may be used by one thread at a time
+	class reader {
+	public:
+		explicit reader(rcu_pointer &rcu): rcu(rcu), slot(rcu.claim_slot()) {
+		}
+
+		~reader() {
+			slot->epoch.store(IDLE, std::memory_order_release);
+			slot->used.store(false, std::memory_order_release);
+		}
+
+		// Pins the current object until unlock, returns null if nothing has been published
+		const T *lock() {
+			slot->epoch.store(rcu.epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+			return rcu.current.load(std::memory_order_seq_cst);
+		}
+
+		void unlock() {
+			slot->epoch.store(IDLE, std::memory_order_release);
+		}
+
+	private:
+		reader(const reader &);
+		reader &operator =(const reader &);
+
+		rcu_pointer &rcu;
+		slot_t *slot;
+	};
+
+	// lock() ... unlock() of a reader for a scope
+	class read_guard {
+	public:
+		explicit read_guard(reader &r): r(r), object(r.lock()) {
+		}
+
+		~read_guard() {
+			r.unlock();
+		}
+
+		const T *get() const {
+			return object;
+		}
+
+	private:
+		read_guard(const read_guard &);
+		read_guard &operator =(const read_guard &);
+
+		reader &r;
+		const T *object;
+	};
+
+	rcu_pointer(): current(nullptr), epoch(1) {
+		for (auto &s : slots) {
+			s.epoch.store(IDLE, std::memory_order_relaxed);
+			s.used.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	// readers must be gone by now
+	~rcu_pointer() {
+		delete current.load();
+		for (const auto &r : retired) {
+			delete r.object;
+		}
+	}
+
+	// Writer side: replaces the object, takes ownership of next
+	void publish(T *next) {
+		T *prev = current.exchange(next, std::memory_order_seq_cst);
+		if (prev) {
+			retired.push_back(retired_t{ prev, epoch.load(std::memory_order_relaxed) });
+		}
+		epoch.fetch_add(1, std::memory_order_seq_cst);
+		reclaim();
+	}
+
+	// objects replaced but not deleted yet, pinned by a slow reader
+	size_t retired_size() const {
+		return retired.size();
+	}
+
+private:
+	rcu_pointer(const rcu_pointer &);
+	rcu_pointer &operator =(const rcu_pointer &);
+
+	static const uint64_t IDLE = ~uint64_t(0);
+	enum { CACHE_LINE = 64 };
+
+	struct slot_t {
+		std::atomic<uint64_t> epoch; // IDLE outside of lock() ... unlock()
+		std::atomic<bool> used;
+		char pad[CACHE_LINE - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
+	};
+
+	struct retired_t {
+		T *object;
+		uint64_t epoch;
+	};
+
+	slot_t *claim_slot() {
+		for (auto &s : slots) {
+			bool expected = false;
+			if (!s.used.load(std::memory_order_relaxed) &&
+				s.used.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+				return &s;
+			}
+		}
+		throw std::runtime_error("rcu_pointer: too many readers");
+	}
+
+	void reclaim() {
+		uint64_t oldest = IDLE;
+		for (const auto &s : slots) {
+			const uint64_t e = s.epoch.load(std::memory_order_seq_cst);
+			if (e < oldest) {
+				oldest = e;
+			}
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < retired.size(); ++i) {
+			if (retired[i].epoch < oldest) {
+				delete retired[i].object;
+			} else {
+				retired[kept++] = retired[i];
+			}
+		}
+		retired.resize(kept);
+	}
+
+	std::atomic<T *> current;
+	std::atomic<uint64_t> epoch;
+	slot_t slots[MAX_READERS];
+	std::vector<retired_t> retired; // writer only
+};
+
+#endif // RCU_POINTER_HPP
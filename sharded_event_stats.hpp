@@ -0,0 +1,287 @@
+#ifndef SHARDED_EVENT_STATS_HPP
+#define SHARDED_EVENT_STATS_HPP
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "event_stats.hpp"
+#include "spsc_queue.hpp"
+
+// Front-end over independent event_stats shards, events are spread by key hash.
+// With num_threads > 0 every shard is owned by a worker thread which is fed through an
+// SPSC queue by the single producer (parser) thread; with 0 there is a single shard
+// updated inline. A key always goes to the same shard, so get_top merges per-shard
+// top-k lists without combining values. events_limit is split evenly between shards,
+// all of them use the same event_stats strategy. Periodic maintenance (tick) goes through
+// the queues as well, so the producer only ever appends to them.
+template<typename E>
+class sharded_event_stats
+{
+public:
+    typedef event_stats<E> shard_t;
+
+private:
+
+    // an event to add, or a tick of the shard as of time
+    struct item_t
+    {
+        E event;
+        time_t time;
+        bool tick;
+    };
+
+    struct worker_t
+    {
+        worker_t(const std::string &strategy, size_t events_limit, size_t top_k, int period_in_seconds,
+                 const std::vector<int> &windows_in_seconds)
+        : stats( shard_t::create( strategy, events_limit, top_k, period_in_seconds, windows_in_seconds ) ),
+         queue(QUEUE_SIZE),
+         pushed(0),
+         processed(0)
+        {}
+
+        std::unique_ptr<shard_t> stats;
+        spsc_queue<item_t> queue;
+        size_t pushed; // written by the producer only
+        std::atomic<size_t> processed;
+        std::thread thread;
+    };
+
+    enum { QUEUE_SIZE = 1 << 16 };
+
+public:
+    // windows_in_seconds as in event_stats::create
+    sharded_event_stats(const std::string &strategy, size_t events_limit, size_t top_k, int period_in_seconds, size_t num_threads = 0,
+                        const std::vector<int> &windows_in_seconds = std::vector<int>())
+    : threaded(num_threads > 0),
+     stop(false)
+    {
+        const size_t num_shards = max<size_t>(num_threads, 1);
+        const size_t shard_limit = (events_limit + num_shards - 1) / num_shards;
+        for(size_t i = 0; i < num_shards; ++i)
+        {
+            workers.emplace_back( new worker_t(strategy, shard_limit, top_k, period_in_seconds, windows_in_seconds) );
+        }
+
+        if (threaded)
+        {
+            for( auto &w : workers )
+            {
+                w->thread = std::thread( &sharded_event_stats::run, this, w.get() );
+            }
+        }
+    }
+
+    ~sharded_event_stats()
+    {
+        stop.store( true, std::memory_order_release );
+        for( auto &w : workers )
+        {
+            if (w->thread.joinable())
+                w->thread.join();
+        }
+    }
+
+    void add_event(const E &event, time_t time)
+    {
+        worker_t *w = workers[ shard_of( event.key ) ].get();
+        if (!threaded)
+        {
+            w->stats->add_event( event, time );
+            return;
+        }
+
+        const item_t item = { event, time, false };
+        push( *w, item );
+    }
+
+    // adds events with their own time
+    void add_events(const E *events, size_t count)
+    {
+        if (!threaded)
+        {
+            workers[0]->stats->add_events( events, count );
+            return;
+        }
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            add_event( events[i], events[i].time );
+        }
+    }
+
+    // With worker threads the tick is queued to every shard behind its events, so slice
+    // building and expiration run on the workers, in parallel and off the producer thread
+    void tick(time_t time)
+    {
+        if (!threaded)
+        {
+            workers[0]->stats->tick( time );
+            return;
+        }
+
+        item_t item;
+        item.time = time;
+        item.tick = true;
+        for( auto &w : workers )
+        {
+            push( *w, item );
+        }
+    }
+
+    template< typename ResultContainer >
+    void get_top(size_t k, int period_in_seconds, time_t time, ResultContainer &top_size, ResultContainer &top_freq)
+    {
+        if (workers.size() == 1)
+        {
+            wait_drained( *workers[0] );
+            workers[0]->stats->get_top( k, period_in_seconds, time, top_size, top_freq );
+            return;
+        }
+
+        for( auto &w : workers )
+        {
+            // a drained worker doesn't touch its shard until the next push
+            wait_drained( *w );
+
+            ResultContainer shard_size, shard_freq;
+            w->stats->get_top( k, period_in_seconds, time, shard_size, shard_freq );
+            top_size.insert( top_size.end(), shard_size.begin(), shard_size.end() );
+            top_freq.insert( top_freq.end(), shard_freq.begin(), shard_freq.end() );
+        }
+
+        k = min(top_size.size(), k);
+        std::function<decltype(E::size_compare)> comparator_size( &E::size_compare );
+        partial_sort(top_size.begin(), top_size.begin() + k, top_size.end(), std::not2(comparator_size) );
+        top_size.resize(k);
+
+        k = min(top_freq.size(), k);
+        std::function<decltype(E::size_compare)> comparator_freq( freq_compare() );
+        partial_sort(top_freq.begin(), top_freq.begin() + k, top_freq.end(), std::not2(comparator_freq) );
+        top_freq.resize(k);
+    }
+
+    // order of top_freq results
+    typename shard_t::compare_type freq_compare() const
+    {
+        return workers[0]->stats->freq_compare();
+    }
+
+    template< typename ResultContainer >
+    void export_items(ResultContainer &items, ResultContainer &errors)
+    {
+        for( auto &w : workers )
+        {
+            wait_drained( *w );
+            w->stats->export_items( items, errors );
+        }
+    }
+
+    // calls f for every item of every shard, in the calling thread
+    template< typename F >
+    void for_each_item(F f)
+    {
+        for( auto &w : workers )
+        {
+            wait_drained( *w );
+            w->stats->for_each_item( f );
+        }
+    }
+
+    // errors may be null
+    void import_items(const E *items, const E *errors, size_t count)
+    {
+        std::vector< std::vector<E> > shard_items( workers.size() ), shard_errors( workers.size() );
+        for(size_t i = 0; i < count; ++i)
+        {
+            const size_t shard = shard_of( items[i].key );
+            shard_items[shard].push_back( items[i] );
+            if (errors)
+                shard_errors[shard].push_back( errors[i] );
+        }
+        for(size_t i = 0; i < workers.size(); ++i)
+        {
+            wait_drained( *workers[i] );
+            if (!shard_items[i].empty())
+                workers[i]->stats->import_items( &shard_items[i][0], errors ? &shard_errors[i][0] : nullptr,
+                                                 shard_items[i].size() );
+        }
+    }
+
+private:
+    size_t shard_of( uint64_t key ) const
+    {
+        return mix_id( key ) % workers.size();
+    }
+
+    void push( worker_t &w, const item_t &item )
+    {
+        while( !w.queue.push( item ) )
+        {
+            std::this_thread::yield();
+        }
+        ++w.pushed;
+    }
+
+    void wait_drained( const worker_t &w ) const
+    {
+        while( w.processed.load( std::memory_order_acquire ) != w.pushed )
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void run( worker_t *w )
+    {
+        item_t item;
+        unsigned idle = 0;
+        while( true )
+        {
+            if (w->queue.pop( item ))
+            {
+                process( w, item );
+                idle = 0;
+            }
+            else if (stop.load( std::memory_order_acquire ))
+            {
+                // everything pushed before stop is visible now
+                while( w->queue.pop( item ) )
+                    process( w, item );
+                break;
+            }
+            else if (++idle < 64)
+            {
+                // spin, the next event is usually just behind
+            }
+            else if (idle < 1024)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for( std::chrono::microseconds(100) );
+            }
+        }
+    }
+
+    void process( worker_t *w, const item_t &item )
+    {
+        if (item.tick)
+            w->stats->tick( item.time );
+        else
+            w->stats->add_event( item.event, item.time );
+        w->processed.store( w->processed.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+private:
+    const bool threaded;
+    std::atomic<bool> stop;
+    std::vector< std::unique_ptr<worker_t> > workers;
+};
+
+#endif // SHARDED_EVENT_STATS_HPP
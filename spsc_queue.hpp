@@ -0,0 +1,79 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Capacity is rounded up to a power of two. Head and tail live on separate cache
+// lines, and each side keeps a cached copy of the other side's index, so the shared
+// counters are only reloaded when the queue looks full (empty).
+template<typename T>
+class spsc_queue {
+
+public:
+	explicit spsc_queue(size_t capacity)
+	: head(0), tail(0), cached_head(0), cached_tail(0) {
+		size_t n = 2;
+		while (n < capacity) {
+			n <<= 1;
+		}
+		mask = n - 1;
+		items.reset(new T[n]);
+	}
+
+	// producer side, returns false if the queue is full
+	bool push(const T &item) {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t - cached_head > mask) {
+			cached_head = head.load(std::memory_order_acquire);
+			if (t - cached_head > mask) {
+				return false;
+			}
+		}
+		items[t & mask] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, returns false if the queue is empty
+	bool pop(T &item) {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == cached_tail) {
+			cached_tail = tail.load(std::memory_order_acquire);
+			if (h == cached_tail) {
+				return false;
+			}
+		}
+		item = items[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	spsc_queue(const spsc_queue &);
+	spsc_queue &operator =(const spsc_queue &);
+
+	enum { CACHE_LINE = 64 };
+
+	std::unique_ptr<T[]> items;
+	size_t mask;
+
+	// padding instead of alignas: over-aligned types can't be heap allocated before C++17
+	char pad0[CACHE_LINE];
+	std::atomic<size_t> head;
+	char pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail;
+	char pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+	size_t cached_head; // producer's copy of head
+	char pad3[CACHE_LINE - sizeof(size_t)];
+	size_t cached_tail; // consumer's copy of tail
+	char pad4[CACHE_LINE - sizeof(size_t)];
+};
+
+#endif // SPSC_QUEUE_HPP
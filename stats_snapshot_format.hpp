@@ -0,0 +1,48 @@
+#ifndef STATS_SNAPSHOT_FORMAT_HPP
+#define STATS_SNAPSHOT_FORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include "event_log_format.hpp"
+
+// Binary snapshot of the items tracked by event_stats, shares the encoding helpers
+// of the event log.
+//
+//   magic "ELTOPSN\0", uint32 version, uint32 reserved (little-endian)
+//   zigzag varint snapshot time (the latest item time)
+//   varint number of items
+//   varint 1 if the items have errors, 0 otherwise (not in version 1)
+//   then every item:
+//     key, request   varint length and bytes
+//     time           varint distance back from the snapshot time
+//     size, freq     varint
+//     freq_double    IEEE 754 bits as uint64
+//     size_error, freq_error  varint, if the items have errors (see event_stats::export_items)
+//
+// A reader refuses versions it doesn't know, so the layout may change with the version.
+// Version 1 is version 2 without errors.
+namespace stats_snapshot {
+
+static const char magic[8] = { 'E', 'L', 'T', 'O', 'P', 'S', 'N', '\0' };
+static const uint32_t version = 2;
+static const size_t header_size = sizeof(magic) + 2 * sizeof(uint32_t);
+
+inline bool has_magic(const char *data, size_t size) {
+	return size >= header_size && !memcmp(data, magic, sizeof(magic));
+}
+
+inline uint64_t double_bits(double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+inline double bits_double(uint64_t bits) {
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+} // namespace stats_snapshot
+
+#endif // STATS_SNAPSHOT_FORMAT_HPP
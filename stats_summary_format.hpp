@@ -0,0 +1,35 @@
+#ifndef STATS_SUMMARY_FORMAT_HPP
+#define STATS_SUMMARY_FORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include "event_log_format.hpp"
+#include "stats_snapshot_format.hpp"
+
+// Binary file of an event_summary, shares the encoding helpers of the event log.
+//
+//   magic "ELTOPSM\0", uint32 version, uint32 flags (little-endian)
+//   varint capacity
+//   list by size, then list by frequency, each of them:
+//     bound          counters
+//     varint number of entries, then every entry:
+//       key, request   varint length and bytes
+//       time           zigzag varint
+//       value, error   counters
+//
+// where counters are varint size, varint freq and freq_double as IEEE 754 bits in uint64.
+// With flag_freq_double the frequency list is ordered by freq_double, by freq otherwise.
+namespace stats_summary {
+
+static const char magic[8] = { 'E', 'L', 'T', 'O', 'P', 'S', 'M', '\0' };
+static const uint32_t version = 1;
+static const uint32_t flag_freq_double = 1;
+static const size_t header_size = sizeof(magic) + 2 * sizeof(uint32_t);
+
+inline bool has_magic(const char *data, size_t size) {
+	return size >= header_size && !memcmp(data, magic, sizeof(magic));
+}
+
+} // namespace stats_summary
+
+#endif // STATS_SUMMARY_FORMAT_HPP
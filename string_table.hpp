@@ -0,0 +1,173 @@
+#ifndef STRING_TABLE_HPP
+#define STRING_TABLE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Spreads a dense id over all 64 bits (the splitmix64 finalizer), for hash tables,
+// shards and sketches indexed by interned ids.
+inline uint64_t mix_id(uint64_t id) {
+	id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	id = (id ^ (id >> 27)) * 0x94d049bb133111ebULL;
+	return id ^ (id >> 31);
+}
+
+// Interning table for keys and request names.
+// Every distinct string is copied once into an arena and gets a dense 64-bit id,
+// so the rest of the code compares and hashes plain integers; reverse lookup is
+// only needed when results are reported. A long running process drops the strings
+// nothing refers to any more with collect(), their ids are then reused by intern.
+class string_table {
+
+public:
+	typedef uint64_t id_type;
+
+	string_table(size_t arena_chunk_size = 1 << 20)
+	: chunk_size(arena_chunk_size), chunk_used(0), mask(0) {
+		rehash(1024);
+	}
+
+	id_type intern(const char *str, size_t len) {
+		const size_t h = hash(str, len);
+		size_t i = h & mask;
+		for ( ; slots[i].id != empty_slot; i = (i + 1) & mask) {
+			if (slots[i].hash == h) {
+				const entry_t &e = entries[slots[i].id];
+				if (e.len == len && !memcmp(e.str, str, len)) {
+					return slots[i].id;
+				}
+			}
+		}
+
+		id_type id = entries.size();
+		if (free_ids.empty()) {
+			entries.push_back( entry_t{ store(str, len), len } );
+		} else {
+			id = free_ids.back();
+			free_ids.pop_back();
+			entries[id] = entry_t{ store(str, len), len };
+		}
+		slots[i].hash = h;
+		slots[i].id = id;
+
+		if (2 * count() > slots.size()) {
+			rehash(2 * slots.size());
+		}
+		return id;
+	}
+
+	id_type intern(const std::string &str) {
+		return intern(str.data(), str.size());
+	}
+
+	const char *lookup(id_type id) const {
+		return entries[id].str;
+	}
+
+	size_t length(id_type id) const {
+		return entries[id].len;
+	}
+
+	// ids are below size()
+	size_t size() const {
+		return entries.size();
+	}
+
+	// number of strings held
+	size_t count() const {
+		return entries.size() - free_ids.size();
+	}
+
+	// Keeps the strings whose live[id] is set and frees the others. Strings are moved
+	// to a new arena, so pointers from lookup() are invalidated, ids of live strings
+	// stay the same.
+	void collect(const std::vector<bool> &live) {
+		std::vector< std::unique_ptr<char[]> > old_arena;
+		old_arena.swap(arena);
+		chunk_used = 0;
+		free_ids.clear();
+		for (id_type id = 0; id < entries.size(); ++id) {
+			if (id < live.size() && live[id] && entries[id].str) {
+				entries[id].str = store(entries[id].str, entries[id].len);
+			} else {
+				entries[id] = entry_t{ nullptr, 0 };
+				free_ids.push_back(id);
+			}
+		}
+		// lowest ids are reused first
+		std::reverse(free_ids.begin(), free_ids.end());
+
+		size_t capacity = 1024;
+		while (2 * count() > capacity) {
+			capacity *= 2;
+		}
+		rehash(capacity);
+	}
+
+private:
+	struct entry_t {
+		const char *str;
+		size_t len;
+	};
+
+	struct slot_t {
+		size_t hash;
+		id_type id;
+	};
+
+	static const id_type empty_slot = ~id_type(0);
+
+	static size_t hash(const char *str, size_t len) {
+		// FNV-1a
+		size_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < len; ++i) {
+			h ^= static_cast<unsigned char>(str[i]);
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	// copy string into the arena, keeping it null-terminated for printing
+	const char *store(const char *str, size_t len) {
+		if (arena.empty() || chunk_used + len + 1 > chunk_size) {
+			arena.emplace_back( new char[std::max(chunk_size, len + 1)] );
+			chunk_used = 0;
+		}
+		char *dst = arena.back().get() + chunk_used;
+		memcpy(dst, str, len);
+		dst[len] = '\0';
+		chunk_used += len + 1;
+		return dst;
+	}
+
+	void rehash(size_t capacity) {
+		slots.assign(capacity, slot_t{0, empty_slot});
+		mask = capacity - 1;
+		for (id_type id = 0; id < entries.size(); ++id) {
+			if (!entries[id].str) {
+				continue;
+			}
+			const size_t h = hash(entries[id].str, entries[id].len);
+			size_t i = h & mask;
+			while (slots[i].id != empty_slot) {
+				i = (i + 1) & mask;
+			}
+			slots[i].hash = h;
+			slots[i].id = id;
+		}
+	}
+
+	size_t chunk_size;
+	size_t chunk_used;
+	std::vector< std::unique_ptr<char[]> > arena;
+	std::vector<entry_t> entries;
+	std::vector<id_type> free_ids;
+	std::vector<slot_t> slots;
+	size_t mask;
+};
+
+#endif // STRING_TABLE_HPP
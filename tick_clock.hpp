@@ -0,0 +1,135 @@
+#ifndef TICK_CLOCK_HPP
+#define TICK_CLOCK_HPP
+
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include "event.hpp"
+#include "observer.hpp"
+
+// Receives a tick for every second of the clock driving it, in order, from the thread
+// that feeds event_stats
+struct ITickHandler
+{
+    virtual void OnTick( time_t time ) = 0;
+    virtual ~ITickHandler() {}
+};
+
+// Clock of a replay: time is the time of the events. Every second from the first event on
+// is ticked once the first event of a later second arrives, seconds without events
+// included, so handlers see the seconds the events cover and nothing happens in between.
+// Subscribed after the observers feeding event_stats, it ticks after the event that
+// starts the new second is added, as the per-second top has always been taken.
+class ReplayClock : public IObserver
+{
+public:
+    ReplayClock()
+    : last_time_( 0 )
+    {}
+
+    // handlers are ticked in the order of subscription
+    void Subscribe( ITickHandler *handler )
+    {
+        handlers_.push_back( handler );
+    }
+
+private:
+    // IObserver
+    virtual void NotifyObserver( const Event &event )
+    {
+        if (!last_time_)
+            last_time_ = event.time;
+
+        while( last_time_ < event.time )
+        {
+            ++last_time_;
+            for( auto handler : handlers_ )
+            {
+                handler->OnTick( last_time_ );
+            }
+        }
+    }
+
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        if (!last_time_)
+            last_time_ = events[0].time;
+
+        // all events but the last one share the time of the previous batch
+        NotifyObserver( events[count - 1] );
+    }
+
+private:
+    vector<ITickHandler *> handlers_;
+    time_t last_time_;
+};
+
+// Clock of the daemon: driven by the wall clock every second, but never behind the newest
+// event ingested. Event times come from the log timestamps, which may run ahead of the wall
+// clock (clock skew, a zone given wrongly with -z); ticking by the wall clock alone would
+// then keep them from expiring and leave slices unbuilt until the wall clock catches up.
+// Only events less than MAX_AHEAD seconds ahead of the wall clock move it, which covers any
+// zone offset; a line stamped further ahead is an outlier that would otherwise hold the
+// clock there and keep every real event from expiring.
+// Seconds are ticked once each and in order; a jump of more than MAX_CATCH_UP seconds (the
+// first tick, a timestamp far ahead) ticks only its last second.
+class DaemonClock : public IObserver
+{
+    enum { MAX_CATCH_UP = 60 };
+    enum { MAX_AHEAD = 15 * 3600 };
+
+public:
+    DaemonClock()
+    : wall_time_( time( nullptr ) ),
+     newest_time_( 0 ),
+     last_time_( 0 )
+    {}
+
+    // handlers are ticked in the order of subscription
+    void Subscribe( ITickHandler *handler )
+    {
+        handlers_.push_back( handler );
+    }
+
+    // a second of wall clock time has passed
+    void Tick( time_t wall_time )
+    {
+        wall_time_ = wall_time;
+        const time_t time = max( wall_time, newest_time_ );
+        if (time - last_time_ > MAX_CATCH_UP)
+            last_time_ = time - 1;
+
+        while( last_time_ < time )
+        {
+            ++last_time_;
+            for( auto handler : handlers_ )
+            {
+                handler->OnTick( last_time_ );
+            }
+        }
+    }
+
+private:
+    // IObserver
+    virtual void NotifyObserver( const Event &event )
+    {
+        if (event.time < wall_time_ + MAX_AHEAD)
+            newest_time_ = max( newest_time_, event.time );
+    }
+
+    virtual void NotifyBatch( const Event *events, size_t count )
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            NotifyObserver( events[i] );
+        }
+    }
+
+private:
+    vector<ITickHandler *> handlers_;
+    time_t wall_time_;
+    time_t newest_time_;
+    time_t last_time_;
+};
+
+#endif // TICK_CLOCK_HPP
@@ -0,0 +1,174 @@
+#ifndef TIMESTAMP_DECODER_HPP
+#define TIMESTAMP_DECODER_HPP
+
+#include <ctime>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+// Decoder of "%Y-%m-%d %H:%M:%S" timestamps.
+// Consecutive log lines almost always share the date and hour, so the epoch time of the
+// "YYYY-MM-DD HH" prefix is cached and only minutes and seconds are added per call.
+// By default the prefix is converted with mktime as local time, daylight saving time
+// included (tm_isdst = -1), once per hour; with a fixed UTC offset it is computed
+// arithmetically. Timestamps not in the fixed-width form fall back to strptime + mktime.
+// encode formats epoch time back into the same form and zone with localtime, so it is the
+// inverse of decode; only the hour repeated when DST ends decodes as one of its two times.
+class timestamp_decoder {
+
+public:
+	timestamp_decoder(): local(true), utc_offset(0), cached(false) {
+	}
+
+	// decode timestamps as local time
+	void set_local() {
+		local = true;
+		cached = false;
+	}
+
+	// decode timestamps as time at a fixed offset east of UTC, 0 for UTC itself
+	void set_utc_offset(long offset_in_seconds) {
+		local = false;
+		utc_offset = offset_in_seconds;
+		cached = false;
+	}
+
+	// parses "utc", "local", "+HH", "+HHMM" or "+HH:MM" (or with '-'), returns false on malformed input
+	bool set_zone(const std::string &zone) {
+		if (zone == "local") {
+			set_local();
+			return true;
+		}
+		if (zone == "utc" || zone == "UTC") {
+			set_utc_offset(0);
+			return true;
+		}
+		if (zone.size() < 3 || (zone[0] != '+' && zone[0] != '-')) {
+			return false;
+		}
+
+		std::string digits;
+		for (size_t i = 1; i < zone.size(); ++i) {
+			if (zone[i] == ':' && i == 3) {
+				continue;
+			}
+			if (zone[i] < '0' || zone[i] > '9') {
+				return false;
+			}
+			digits += zone[i];
+		}
+		if (digits.size() != 2 && digits.size() != 4) {
+			return false;
+		}
+
+		long offset = atoi(digits.substr(0, 2).c_str()) * 3600;
+		if (digits.size() == 4) {
+			offset += atoi(digits.substr(2, 2).c_str()) * 60;
+		}
+		set_utc_offset(zone[0] == '-' ? -offset : offset);
+		return true;
+	}
+
+	time_t decode(const char *str, size_t len) {
+		if (!fixed_width(str, len)) {
+			return decode_slow(str, len);
+		}
+
+		if (!cached || memcmp(prefix, str, PREFIX_LEN)) {
+			memcpy(prefix, str, PREFIX_LEN);
+			prefix_time = decode_prefix(str);
+			cached = true;
+		}
+		return prefix_time + number(str + 14) * 60 + number(str + 17);
+	}
+
+	enum { TIMESTAMP_LEN = 19 };
+
+	// formats time in the zone timestamps are decoded in, the reverse of decode;
+	// writes TIMESTAMP_LEN characters and a terminating zero
+	void encode(time_t time, char *str) const {
+		struct std::tm tm;
+		if (local) {
+			localtime_r(&time, &tm);
+		} else {
+			const time_t shifted = time + utc_offset;
+			gmtime_r(&shifted, &tm);
+		}
+		strftime(str, TIMESTAMP_LEN + 1, "%Y-%m-%d %H:%M:%S", &tm);
+	}
+
+private:
+	enum { PREFIX_LEN = 13 };
+
+	static int number(const char *str) {
+		return (str[0] - '0') * 10 + (str[1] - '0');
+	}
+
+	static bool fixed_width(const char *str, size_t len) {
+		if (len < TIMESTAMP_LEN) {
+			return false;
+		}
+		static const char format[] = "dddd-dd-dd dd:dd:dd";
+		for (size_t i = 0; i < TIMESTAMP_LEN; ++i) {
+			if (format[i] == 'd' ? (str[i] < '0' || str[i] > '9') : str[i] != format[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// days since 1970-01-01 in the proleptic Gregorian calendar
+	static long days_from_civil(long y, unsigned m, unsigned d) {
+		y -= m <= 2;
+		const long era = (y >= 0 ? y : y - 399) / 400;
+		const unsigned yoe = static_cast<unsigned>(y - era * 400);
+		const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+		const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + static_cast<long>(doe) - 719468;
+	}
+
+	time_t decode_prefix(const char *str) const {
+		const int year = number(str) * 100 + number(str + 2);
+		const int month = number(str + 5);
+		const int day = number(str + 8);
+		const int hour = number(str + 11);
+
+		if (local) {
+			struct std::tm tm;
+			memset(&tm, 0, sizeof(struct std::tm));
+			tm.tm_year = year - 1900;
+			tm.tm_mon = month - 1;
+			tm.tm_mday = day;
+			tm.tm_hour = hour;
+			tm.tm_isdst = -1;
+			return mktime(&tm);
+		}
+		return days_from_civil(year, month, day) * 86400 + hour * 3600 - utc_offset;
+	}
+
+	time_t decode_slow(const char *str, size_t len) const {
+		char buf[64];
+		len = std::min(len, sizeof(buf) - 1);
+		memcpy(buf, str, len);
+		buf[len] = '\0';
+
+		struct std::tm tm;
+		memset(&tm, 0, sizeof(struct std::tm));
+		strptime(buf, "%Y-%m-%d %H:%M:%S", &tm);
+		if (local) {
+			tm.tm_isdst = -1;
+			return mktime(&tm);
+		}
+		return days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400 +
+			tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec - utc_offset;
+	}
+
+	bool local;
+	long utc_offset;
+	bool cached;
+	char prefix[PREFIX_LEN];
+	time_t prefix_time;
+};
+
+#endif // TIMESTAMP_DECODER_HPP
@@ -0,0 +1,315 @@
+#ifndef TOP_SERVER_HPP
+#define TOP_SERVER_HPP
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "rcu_pointer.hpp"
+
+using namespace std;
+
+// Top of event_stats as of one second in each of its windows, immutable once published.
+// Keys and requests are copied out of the string table, which only the ingestion thread may touch.
+struct TopSnapshot
+{
+    struct Entry
+    {
+        string key;
+        string request;
+        uint64_t size;
+        uint64_t freq;
+        double freq_double;
+        time_t time;
+    };
+
+    struct Window
+    {
+        int period; // seconds
+        vector<Entry> top_size, top_freq;
+    };
+
+    time_t time;
+    vector<Window> windows; // ascending, the last one is the default
+};
+
+// Latest published snapshot: the ingestion thread publishes, query threads read without locks
+typedef rcu_pointer<TopSnapshot> TopPublisher;
+
+// Answers top-k queries over a Unix stream socket from its own thread.
+// A request is a line "top [k] [size|freq] [<window>s]", the response is one line of JSON:
+//   {"time":T,"window":W,"top_size":[{"key":"..","request":"..","size":S,"freq":F,"freq_d":D,"time":T},...],"top_freq":[...]}
+// with both lists, or only the one asked for, cut at k entries, of the window asked for
+// (one of the published ones, the longest by default). Errors are answered with
+// {"error":"..."}. Responses are made of the latest published snapshot only.
+// A client is answered while less than MAX_OUTPUT bytes of responses wait for it to read
+// them, until then its socket isn't read either.
+class TopServer
+{
+    struct Client
+    {
+        int fd;
+        string in, out;
+        bool eof; // the client is done sending, it still gets the responses
+    };
+
+    enum { MAX_REQUEST = 1024, READ_SIZE = 4096, MAX_OUTPUT = 1 << 20 };
+
+public:
+    TopServer( const string &socket_path, TopPublisher &publisher )
+    : path_( socket_path ),
+     reader_( publisher )
+    {
+        sockaddr_un addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sun_family = AF_UNIX;
+        if (path_.size() >= sizeof(addr.sun_path))
+            throw invalid_argument( "socket path is too long: " + path_ );
+        memcpy( addr.sun_path, path_.c_str(), path_.size() );
+
+        listen_fd_ = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+        if (listen_fd_ < 0)
+            throw runtime_error( string( "socket: " ) + strerror( errno ) );
+
+        // a socket left by a previous run
+        unlink( path_.c_str() );
+        if (bind( listen_fd_, reinterpret_cast<sockaddr *>( &addr ), sizeof(addr) ) < 0 ||
+            listen( listen_fd_, SOMAXCONN ) < 0)
+        {
+            const string error = strerror( errno );
+            close( listen_fd_ );
+            throw runtime_error( "can't listen on " + path_ + ": " + error );
+        }
+
+        if (pipe2( wake_, O_NONBLOCK | O_CLOEXEC ) < 0)
+        {
+            const string error = strerror( errno );
+            close( listen_fd_ );
+            unlink( path_.c_str() );
+            throw runtime_error( "pipe2: " + error );
+        }
+
+        thread_ = thread( &TopServer::Run, this );
+    }
+
+    ~TopServer()
+    {
+        const char wake = 0;
+        while( write( wake_[1], &wake, 1 ) < 0 && errno == EINTR )
+        {}
+        thread_.join();
+
+        for( const auto &c : clients_ )
+        {
+            close( c.fd );
+        }
+        close( listen_fd_ );
+        close( wake_[0] );
+        close( wake_[1] );
+        unlink( path_.c_str() );
+    }
+
+    // response to a request line given without its '\n'
+    static string Respond( const string &request, const TopSnapshot *snapshot )
+    {
+        istringstream words( request );
+        string command, word, list;
+        size_t k = ~size_t(0);
+        int period = 0;
+        words >> command;
+        if (command != "top")
+            return "{\"error\":\"unknown command\"}\n";
+        while( words >> word )
+        {
+            char *end;
+            const unsigned long number = strtoul( word.c_str(), &end, 10 );
+            if (word == "size" || word == "freq")
+                list = word;
+            else if (isdigit( (unsigned char)word[0] ) && !*end)
+                k = number;
+            else if (isdigit( (unsigned char)word[0] ) && !strcmp( end, "s" ) && number)
+                period = number;
+            else
+                return "{\"error\":\"k, size, freq or <window>s expected\"}\n";
+        }
+        if (!snapshot)
+            return "{\"error\":\"no data yet\"}\n";
+
+        const TopSnapshot::Window *window = &snapshot->windows.back();
+        if (period)
+        {
+            window = nullptr;
+            for( const auto &w : snapshot->windows )
+            {
+                if (w.period == period)
+                    window = &w;
+            }
+            if (!window)
+                return "{\"error\":\"unknown window\"}\n";
+        }
+
+        ostringstream out;
+        out << "{\"time\":" << snapshot->time << ",\"window\":" << window->period;
+        if (list != "freq")
+            WriteList( out, "top_size", window->top_size, k );
+        if (list != "size")
+            WriteList( out, "top_freq", window->top_freq, k );
+        out << "}\n";
+        return out.str();
+    }
+
+private:
+    static void WriteList( ostream &out, const char *name, const vector<TopSnapshot::Entry> &list, size_t k )
+    {
+        out << ",\"" << name << "\":[";
+        for(size_t i = 0; i < list.size() && i < k; ++i)
+        {
+            const TopSnapshot::Entry &e = list[i];
+            if (i)
+                out << ',';
+            out << "{\"key\":";
+            WriteString( out, e.key );
+            out << ",\"request\":";
+            WriteString( out, e.request );
+            out << ",\"size\":" << e.size << ",\"freq\":" << e.freq
+                << ",\"freq_d\":" << e.freq_double << ",\"time\":" << e.time << '}';
+        }
+        out << ']';
+    }
+
+    static void WriteString( ostream &out, const string &s )
+    {
+        out << '"';
+        for( unsigned char c : s )
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf( escaped, sizeof(escaped), "\\u%04x", c );
+                out << escaped;
+            }
+            else
+                out << c;
+        }
+        out << '"';
+    }
+
+    void Run()
+    {
+        vector<pollfd> fds;
+        while( true )
+        {
+            fds.clear();
+            fds.push_back( pollfd{ wake_[0], POLLIN, 0 } );
+            fds.push_back( pollfd{ listen_fd_, POLLIN, 0 } );
+            for( const auto &c : clients_ )
+            {
+                short events = !c.eof && c.out.size() < MAX_OUTPUT ? POLLIN : 0;
+                if (!c.out.empty())
+                    events |= POLLOUT;
+                fds.push_back( pollfd{ c.fd, events, 0 } );
+            }
+
+            if (poll( &fds[0], fds.size(), -1 ) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                cerr << "top server: poll: " << strerror( errno ) << endl;
+                return;
+            }
+            if (fds[0].revents)
+                return;
+
+            // clients accepted below are polled from the next round on
+            for(size_t i = clients_.size(); i-- > 0; )
+            {
+                if (fds[i + 2].revents && !Serve( clients_[i], fds[i + 2].revents ))
+                {
+                    close( clients_[i].fd );
+                    clients_.erase( clients_.begin() + i );
+                }
+            }
+
+            if (fds[1].revents & POLLIN)
+                Accept();
+        }
+    }
+
+    void Accept()
+    {
+        while( true )
+        {
+            const int fd = accept4( listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+            if (fd < 0)
+                return;
+            clients_.push_back( Client{ fd, string(), string(), false } );
+        }
+    }
+
+    // returns false when the client is to be disconnected
+    bool Serve( Client &c, short revents )
+    {
+        if (revents & POLLIN)
+        {
+            char buf[READ_SIZE];
+            const ssize_t n = recv( c.fd, buf, sizeof(buf), 0 );
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+                return false;
+            if (n == 0)
+                c.eof = true;
+            if (n > 0)
+                c.in.append( buf, n );
+        }
+        else if (revents & (POLLERR | POLLHUP))
+            return false;
+
+        if (!c.out.empty())
+        {
+            const ssize_t n = send( c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL );
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+                return false;
+            if (n > 0)
+                c.out.erase( 0, n );
+        }
+
+        // requests left over by a full output are answered as it is sent
+        size_t eol;
+        while( c.out.size() < MAX_OUTPUT && ( eol = c.in.find( '\n' ) ) != string::npos )
+        {
+            {
+                TopPublisher::read_guard guard( reader_ );
+                c.out += Respond( c.in.substr( 0, eol ), guard.get() );
+            }
+            c.in.erase( 0, eol + 1 );
+        }
+        if (c.in.find( '\n' ) == string::npos && (c.in.size() > MAX_REQUEST || (c.eof && c.out.empty())))
+            return false;
+        return true;
+    }
+
+private:
+    string path_;
+    TopPublisher::reader reader_;
+    int listen_fd_;
+    int wake_[2];
+    vector<Client> clients_;
+    thread thread_;
+};
+
+#endif // TOP_SERVER_HPP
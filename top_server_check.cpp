@@ -0,0 +1,67 @@
+#include <iostream>
+#include <string>
+#include "top_server.hpp"
+
+// Checks of the requests TopServer::Respond parses, exits with 1 on a failure
+
+static int failures = 0;
+
+static size_t Count( const string &s, const string &what )
+{
+    size_t n = 0;
+    for(size_t pos = s.find( what ); pos != string::npos; pos = s.find( what, pos + 1 ))
+        ++n;
+    return n;
+}
+
+// response to request has entries keys in the size and the freq list together
+// and contains expected
+static void Check( const string &request, const TopSnapshot *snapshot, size_t entries, const string &expected )
+{
+    const string response = TopServer::Respond( request, snapshot );
+    if (Count( response, "\"key\":" ) != entries || response.find( expected ) == string::npos)
+    {
+        cerr << "\"" << request << "\": " << response;
+        ++failures;
+    }
+}
+
+static TopSnapshot::Window MakeWindow( int period, size_t n )
+{
+    TopSnapshot::Window window;
+    window.period = period;
+    for(size_t i = 0; i < n; ++i)
+    {
+        TopSnapshot::Entry e = { "key" + to_string( i ), "10.0.0.1:1000", 1000 - i, 10 - i, 10. - i, 1419206400 };
+        window.top_size.push_back( e );
+        window.top_freq.push_back( e );
+    }
+    return window;
+}
+
+int main()
+{
+    TopSnapshot snapshot;
+    snapshot.time = 1419206400;
+    snapshot.windows.push_back( MakeWindow( 60, 2 ) );
+    snapshot.windows.push_back( MakeWindow( 300, 3 ) );
+
+    Check( "top", &snapshot, 6, "\"window\":300," );
+    Check( "top size", &snapshot, 3, "\"top_size\":[{" );
+    Check( "top freq", &snapshot, 3, "\"top_freq\":[{" );
+    Check( "top 2", &snapshot, 4, "\"time\":1419206400," );
+    Check( "top 1 size", &snapshot, 1, "\"key\":\"key0\"" );
+    Check( "top freq 2", &snapshot, 2, "\"top_freq\"" );
+    Check( "top 0", &snapshot, 0, "\"top_size\":[]" );
+    Check( "top 60s", &snapshot, 4, "\"window\":60," );
+    Check( "top 1 freq 300s", &snapshot, 1, "\"window\":300," );
+    Check( "top 7s", &snapshot, 0, "unknown window" );
+    Check( "top many", &snapshot, 0, "\"error\"" );
+    Check( "top -1", &snapshot, 0, "\"error\"" );
+    Check( "bottom", &snapshot, 0, "unknown command" );
+    Check( "top", nullptr, 0, "no data yet" );
+
+    if (failures)
+        cerr << failures << " checks failed" << endl;
+    return failures ? 1 : 0;
+}
@@ -19,28 +19,169 @@
 //#include "cache.hpp"
 #include <stdexcept>
 #include <unordered_set>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include "string_table.hpp"
 
 //namespace ioremap { namespace cache {
 
 template<typename T>
 class treap_node_t {
 public:
-	treap_node_t(): l(NULL), r(NULL) {}
+	treap_node_t(): l(NULL), r(NULL), p(NULL) {}
 	T *l;
 	T *r;
+	T *p;
+};
+
+// Open-addressing (linear probing) hash index from node key to node.
+// Keys are integer ids, slots keep the mixed key hash to skip node loads on a miss.
+template<typename node_type>
+class treap_index {
+
+public:
+	typedef node_type* p_node_type;
+	typedef typename node_type::key_type key_type;
+
+	treap_index(): mask(0), count(0) {
+	}
+
+	void reserve(size_t n) {
+		size_t capacity = 16;
+		while (capacity < 2 * n) {
+			capacity <<= 1;
+		}
+		if (capacity > slots.size()) {
+			rehash(capacity);
+		}
+	}
+
+	bool enabled() const {
+		return !slots.empty();
+	}
+
+	p_node_type find(const key_type& key) const {
+		const size_t h = hash(key);
+		for (size_t i = h & mask; slots[i].node; i = (i + 1) & mask) {
+			if (slots[i].hash == h && slots[i].node->key() == key) {
+				return slots[i].node;
+			}
+		}
+		return NULL;
+	}
+
+	// hints for batched lookups: bring the key's home slot, or the node it points to, into cache
+	void prefetch_slot(const key_type& key) const {
+		__builtin_prefetch(&slots[hash(key) & mask]);
+	}
+
+	void prefetch_node(const key_type& key) const {
+		const slot_t &slot = slots[hash(key) & mask];
+		if (slot.node) {
+			__builtin_prefetch(slot.node);
+		}
+	}
+
+	void insert(p_node_type node) {
+		if (2 * (count + 1) > slots.size()) {
+			rehash(2 * slots.size());
+		}
+		place(hash(get_key(node)), node);
+		++count;
+	}
+
+	void erase(p_node_type node) {
+		size_t i = hash(get_key(node)) & mask;
+		while (slots[i].node != node) {
+			if (!slots[i].node) {
+				throw std::logic_error("erase: element is not indexed");
+			}
+			i = (i + 1) & mask;
+		}
+
+		// backward shift deletion: move up every following slot of the probe chain
+		// whose home position is not in (i, j]
+		slots[i].node = NULL;
+		for (size_t j = (i + 1) & mask; slots[j].node; j = (j + 1) & mask) {
+			const size_t home = slots[j].hash & mask;
+			const bool in_place = (i < j) ? (home > i && home <= j) : (home > i || home <= j);
+			if (!in_place) {
+				slots[i] = slots[j];
+				slots[j].node = NULL;
+				i = j;
+			}
+		}
+		--count;
+	}
+
+	void clear() {
+		for (auto &slot : slots) {
+			slot.node = NULL;
+		}
+		count = 0;
+	}
+
+	static size_t hash(key_type key) {
+		return mix_id(key);
+	}
+
+private:
+	struct slot_t {
+		size_t hash;
+		p_node_type node;
+	};
+
+	static key_type get_key(p_node_type node) {
+		return node->key();
+	}
+
+	void place(size_t h, p_node_type node) {
+		size_t i = h & mask;
+		while (slots[i].node) {
+			i = (i + 1) & mask;
+		}
+		slots[i].hash = h;
+		slots[i].node = node;
+	}
+
+	void rehash(size_t capacity) {
+		std::vector<slot_t> old(capacity, slot_t{0, NULL});
+		old.swap(slots);
+		mask = capacity - 1;
+		for (const auto &slot : old) {
+			if (slot.node) {
+				place(slot.hash, slot.node);
+			}
+		}
+	}
+
+	std::vector<slot_t> slots;
+	size_t mask;
+	size_t count;
 };
 
 struct data_t;
 
+struct treap_stats {
+	size_t size;
+	size_t max_depth;
+	double avg_depth;
+};
+
 template<typename node_type>
 class treap {
 
 public:
 	typedef node_type* p_node_type;
-	typedef const unsigned char * key_type;
+	typedef typename node_type::key_type key_type;
 	typedef size_t priority_type;
 
-	treap(): root(NULL) {
+	// index_capacity > 0 enables the hash index: find becomes O(1) instead of a key descent
+	treap(size_t index_capacity = 0): root(NULL) {
+		if (index_capacity) {
+			index.reserve(index_capacity);
+		}
 	}
 
 	~treap() {
@@ -53,53 +194,151 @@ public:
 		}
 		node->l = NULL;
 		node->r = NULL;
+		node->p = NULL;
 		if (empty())
 			root = node;
 		else
 			insert(root, node);
+		if (index.enabled())
+			index.insert(node);
 	}
 
 	p_node_type find(const key_type& key) const {
 		if (empty()) {
 			return NULL;
 		}
+		if (index.enabled()) {
+			return index.find(key);
+		}
 		return find(root, key);
 	}
 
+	// prefetch the index slot (stage 0) or the node (stage 1) of a key that is about to be looked up
+	void prefetch(const key_type& key, int stage) const {
+		if (index.enabled()) {
+			if (stage == 0)
+				index.prefetch_slot(key);
+			else
+				index.prefetch_node(key);
+		}
+	}
+
 	void erase(const key_type& key) {
-		if (empty()) {
+		p_node_type node = find(key);
+		if (!node) {
 			throw std::logic_error("erase: element does not exist");
 		}
-		erase(root, key);
+		erase(node);
 	}
 
 	void erase(p_node_type node) {
 		if (empty()) {
 			throw std::logic_error("erase: element does not exist");
 		}
-		erase(get_key(node));
+
+		// rotate the node down until it has at most one child, then splice it out
+		while (node->l && node->r) {
+			rotate_up(priority_compare(node->l, node->r) > 0 ? node->l : node->r);
+		}
+		replace_child(node, node->l ? node->l : node->r);
+
+		if (index.enabled())
+			index.erase(node);
 	}
 
-	void decrease_key(p_node_type node) {
-		erase(node);
-		insert(node);
+	// node priority has changed: its event time usually moves forward, which sifts it
+	// down, but an event older than the node's time sifts it up
+	void update_priority(p_node_type node) {
+		if (node->p && priority_compare(node, node->p) > 0) {
+			while (node->p && priority_compare(node, node->p) > 0) {
+				rotate_up(node);
+			}
+			return;
+		}
+		while (true) {
+			p_node_type child = node->l;
+			if (!child || (node->r && priority_compare(node->r, child) > 0)) {
+				child = node->r;
+			}
+			if (!child || priority_compare(child, node) <= 0) {
+				break;
+			}
+			rotate_up(child);
+		}
 	}
 
 	p_node_type top() const {
 		return root;
 	}
 
+	// forget all nodes without deleting them, for nodes owned by someone else
+	void release() {
+		root = NULL;
+		index.clear();
+	}
+
 	bool empty() const {
 		return !root;
 	}
 
+	// calls f(node) for every node, in no particular order
+	template<typename F>
+	void for_each(F f) const {
+		std::vector<p_node_type> stack;
+		if (root) {
+			stack.push_back(root);
+		}
+		while (!stack.empty()) {
+			p_node_type t = stack.back();
+			stack.pop_back();
+			if (t->l) {
+				stack.push_back(t->l);
+			}
+			if (t->r) {
+				stack.push_back(t->r);
+			}
+			f(t);
+		}
+	}
+
+	// walks the whole tree, meant for diagnostics
+	treap_stats stats() const {
+		treap_stats st = {0, 0, 0.};
+		size_t total_depth = 0;
+		std::vector< std::pair<p_node_type, size_t> > stack;
+		if (root) {
+			stack.push_back(std::make_pair(root, 1));
+		}
+		while (!stack.empty()) {
+			p_node_type t = stack.back().first;
+			size_t depth = stack.back().second;
+			stack.pop_back();
+
+			++st.size;
+			total_depth += depth;
+			if (depth > st.max_depth) {
+				st.max_depth = depth;
+			}
+			if (t->l) {
+				stack.push_back(std::make_pair(t->l, depth + 1));
+			}
+			if (t->r) {
+				stack.push_back(std::make_pair(t->r, depth + 1));
+			}
+		}
+		if (st.size) {
+			st.avg_depth = total_depth / (double)st.size;
+		}
+		return st;
+	}
+
 private:
 
 	key_type get_key(p_node_type node) const {
 		if (!node) {
 			throw std::logic_error("getKey: node is NULL");
 		}
-		return reinterpret_cast<key_type>( node->key() );
+		return node->key();
 	}
 
 	priority_type get_priority(p_node_type node) const {
@@ -109,120 +348,131 @@ private:
 		return node->eventtime();
 	}
 
+	// Interned ids grow in the order keys are first seen, that is in priority order,
+	// so comparing them directly would degrade the treap into a list. Keys are
+	// ordered by their (bijective) hash instead.
 	inline int key_compare(const key_type& lhs, const key_type& rhs) const {
-	    //int lhs_size = strlen(reinterpret_cast<const char*>(lhs));
-        //int lhs_size = strlen(reinterpret_cast<const char*>(lhs));
-        return strcmp(reinterpret_cast<const char*>(lhs), reinterpret_cast<const char*>(rhs));
-	}
-
-	inline int priority_compare(const priority_type& lhs, const priority_type& rhs) const {
-		if (lhs < rhs) {
-			return 1;
+		const size_t lhs_hash = treap_index<node_type>::hash(lhs);
+		const size_t rhs_hash = treap_index<node_type>::hash(rhs);
+		if (lhs_hash < rhs_hash) {
+			return -1;
 		}
 
-		if (lhs > rhs) {
-			return -1;
+		if (lhs_hash > rhs_hash) {
+			return 1;
 		}
 
 		return 0;
 	}
 
-	void cleanup(p_node_type t) {
-		if (t) {
-			cleanup(t->l);
-			cleanup(t->r);
-			delete t;
+	// Older event time means higher priority, so the root is always the least recently used node.
+	// Event times are monotonic and many nodes share a second, so ties are broken by a hash of the key:
+	// inside one second the treap then behaves as one with random priorities and stays balanced.
+	inline int priority_compare(p_node_type lhs, p_node_type rhs) const {
+		const priority_type lhs_priority = get_priority(lhs), rhs_priority = get_priority(rhs);
+		if (lhs_priority != rhs_priority) {
+			return lhs_priority < rhs_priority ? 1 : -1;
 		}
-	}
 
-	void split(p_node_type t, key_type key, p_node_type & l, p_node_type & r) {
-		if (!t) {
-			l = NULL;
-			r = NULL;
-		}
-		else if (key_compare(key, get_key(t)) < 0) {
-			split(t->l, key, l, t->l);
-			r = t;
-		}
-		else {
-			split(t->r, key, t->r, r);
-			l = t;
+		// a second, independent mix of the key, the first one already defines the key order
+		const size_t lhs_hash = treap_index<node_type>::hash(~get_key(lhs));
+		const size_t rhs_hash = treap_index<node_type>::hash(~get_key(rhs));
+		if (lhs_hash != rhs_hash) {
+			return lhs_hash < rhs_hash ? 1 : -1;
 		}
+
+		return 0;
 	}
 
-	void insert(p_node_type & t, p_node_type it) {
-		if (!t) {
-			t = it;
-		}
-		else {
-			int cmp_result = priority_compare(get_priority(it), get_priority(t));
-			if (cmp_result == 0) {
-				cmp_result = rand() & 1 ? 1 : -1;
+	// post-order deletion following parent links, no recursion and no extra memory
+	void cleanup(p_node_type t) {
+		while (t) {
+			if (t->l) {
+				t = t->l;
 			}
-			if (cmp_result > 0) {
-				split(t, get_key(it), it->l, it->r);
-				t = it;
+			else if (t->r) {
+				t = t->r;
 			}
 			else {
-				insert((key_compare(get_key(it), get_key(t)) < 0) ? t->l : t->r, it);
+				p_node_type parent = t->p;
+				if (parent) {
+					if (parent->l == t)
+						parent->l = NULL;
+					else
+						parent->r = NULL;
+				}
+				delete t;
+				t = parent;
 			}
 		}
 	}
 
-	void merge(p_node_type & t, p_node_type l, p_node_type r) {
-		if (!l || !r) {
-			t = l ? l : r;
+	// put child in place of node under node's parent
+	void replace_child(p_node_type node, p_node_type child) {
+		p_node_type parent = node->p;
+		if (child) {
+			child->p = parent;
+		}
+		if (!parent) {
+			root = child;
+		}
+		else if (parent->l == node) {
+			parent->l = child;
 		}
 		else {
-			int cmp_result = priority_compare(get_priority(l), get_priority(r));
-			if (cmp_result == 0) {
-				cmp_result = rand() & 1 ? 1 : -1;
-			}
-
-			if (cmp_result > 0) {
-				merge(l->r, l->r, r);
-				t = l;
-			}
-			else {
-				merge(r->l, l, r->l);
-				t = r;
-			}
+			parent->r = child;
 		}
 	}
 
-	void erase (p_node_type & t, const key_type& key) {
-		if (!t) {
-			throw std::logic_error("erase: element does not exist");
-		}
-
-		int cmp_result = key_compare(get_key(t), key);
-		if (cmp_result == 0) {
-			merge(t, t->l, t->r);
+	// rotate node above its parent
+	void rotate_up(p_node_type node) {
+		p_node_type parent = node->p;
+		replace_child(parent, node);
+		if (parent->l == node) {
+			parent->l = node->r;
+			if (node->r)
+				node->r->p = parent;
+			node->r = parent;
 		}
 		else {
-			erase((cmp_result > 0) ? t->l : t->r, key);
+			parent->r = node->l;
+			if (node->l)
+				node->l->p = parent;
+			node->l = parent;
 		}
+		parent->p = node;
 	}
 
-	p_node_type find(p_node_type t, const key_type& key, int depth = 0) const {
-		if (!t) {
-			return NULL;
+	void insert(p_node_type t, p_node_type it) {
+		const key_type key = get_key(it);
+		while (true) {
+			p_node_type &child = (key_compare(key, get_key(t)) < 0) ? t->l : t->r;
+			if (!child) {
+				child = it;
+				it->p = t;
+				break;
+			}
+			t = child;
 		}
 
-		int cmp_result = key_compare(get_key(t), key);
-		if (cmp_result == 0) {
-			return t;
+		while (it->p && priority_compare(it, it->p) > 0) {
+			rotate_up(it);
 		}
+	}
 
-		if (cmp_result > 0) {
-			return find(t->l, key, depth + 1);
-		}
-		else {
-			return find(t->r, key, depth + 1);
+	p_node_type find(p_node_type t, const key_type& key) const {
+		while (t) {
+			int cmp_result = key_compare(get_key(t), key);
+			if (cmp_result == 0) {
+				return t;
+			}
+			t = (cmp_result > 0) ? t->l : t->r;
 		}
+		return NULL;
 	}
 
 	p_node_type root;
+	treap_index<node_type> index;
 };
 
 //}}